@@ -33,27 +33,77 @@
 #include <linux/input.h>
 #include <linux/mutex.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/list.h>
+#include <linux/completion.h>
+#include <linux/gpio.h>
+#include <linux/interrupt.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/sched/types.h>
 
 #include <linux/ioport.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/bitrev.h>
+#include <linux/atomic.h>
+#include <linux/percpu.h>
+#include <linux/miscdevice.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/poll.h>
+#include <linux/uaccess.h>
+#include <linux/wait.h>
 #include <asm/io.h>
 #include <linux/version.h>
 
 MODULE_AUTHOR("Amos42");
 MODULE_DESCRIPTION("GPIO and MCP23017 and Multiplexer and 74HC165 Arcade Joystick Driver");
-MODULE_LICENSE("MIT");
+MODULE_LICENSE("GPL");
 
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,15,0)
-#define HAVE_TIMER_SETUP
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,13,0)
+#define HAVE_HRTIMER_SETUP
 #endif
 
+// sched_setscheduler_nocheck() is no longer exported
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,9,0)
+#define HAVE_SCHED_SETATTR
+#endif
+
+// drivers can stamp events with the time of their sample
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,4,0)
+#define HAVE_INPUT_SET_TIMESTAMP
+#endif
+
+// vm_flags can only be changed through helpers
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,3,0)
+#define HAVE_VM_FLAGS_CLEAR
+#endif
+
+// soft hrtimers expire in softirq context, like the timer_list they replace
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,16,0)
+#define MK_HRTIMER_MODE HRTIMER_MODE_ABS_SOFT
+#define MK_HRTIMER_MODE_REL HRTIMER_MODE_REL_SOFT
+#else
+#define MK_HRTIMER_MODE HRTIMER_MODE_ABS
+#define MK_HRTIMER_MODE_REL HRTIMER_MODE_REL
+#endif
+
+#define CREATE_TRACE_POINTS
+#include "mk_arcade_trace.h"
+
+#include "mk_hal.h"
+#include "mk_bsc.h"
+#include "mk_arcade.h"
 #include "mk_arcade_gpio.h"
 #include "MCP23017.h"
 #include "Multiplexer.h"
 #include "74HC165.h"
+#include "mk_poll.h"
 
 
-#define MK_MAX_DEVICES		9
-
 #ifdef RPI2
 #define PERI_BASE        0x3F000000
 #else
@@ -62,22 +112,10 @@ MODULE_LICENSE("MIT");
 
 #define GPIO_BASE                (PERI_BASE + 0x200000) /* GPIO controller */
 
-#define INP_GPIO(g) *(gpio+((g)/10)) &= ~(7<<(((g)%10)*3))
-#define OUT_GPIO(g) *(gpio+((g)/10)) |=  (1<<(((g)%10)*3))
-#define GPIO_READ(g)  *(gpio + 13) &= (1<<(g))
-
-#define GET_GPIO(g) (*(gpio+13) & (1<<g))
-#define SET_GPIO_ALT(g,a) *(gpio+(((g)/10))) |= (((a)<=3?(a)+4:(a)==4?3:2)<<(((g)%10)*3))
-
-#define GPIO_SET *(gpio+7)
-#define GPIO_CLR *(gpio+10)
-
 #define BSC1_BASE		(PERI_BASE + 0x804000)
+#define SPI0_BASE		(PERI_BASE + 0x204000)
 
 
-static volatile unsigned *gpio;
-static volatile unsigned *bsc1;
-
 struct mk_config {
     int args[MK_MAX_DEVICES];
     unsigned int nargs;
@@ -108,32 +146,125 @@ static struct ext_config ext_cfg __initdata;
 module_param_array_named(ext, ext_cfg.args, int, &(ext_cfg.nargs), 0);
 MODULE_PARM_DESC(ext, "Extend config for Arcade Joystick");
 
-enum mk_type {
-    MK_NONE = 0,
-    MK_ARCADE_GPIO,
-    MK_ARCADE_GPIO_BPLUS,
-    MK_ARCADE_MCP23017,
-    MK_ARCADE_GPIO_TFT,
-    MK_ARCADE_GPIO_CUSTOM,
-    MK_ARCADE_GPIO_MULTIPLEXER,
-    MK_ARCADE_GPIO_74HC165,
-    MK_MAX
+struct mcp_int_config {
+    int args[MK_MAX_DEVICES];
+    unsigned int nargs;
 };
 
+static struct mcp_int_config mcp_int_cfg __initdata;
 
-#define MK_REFRESH_TIME	HZ/100
+module_param_array_named(mcpint, mcp_int_cfg.args, int, &(mcp_int_cfg.nargs), 0);
+MODULE_PARM_DESC(mcpint, "GPIO wired to the INTA/INTB line of each MCP23017 Arcade Joystick, -1 for none");
 
-struct mk_pad {
-    struct input_dev *dev;
-    enum mk_type type;
-    char phys[32];
-    int mcp23017addr;
-    int gpio_maps[16];
-    int start_offs;
-    int button_count;
-    char current_button_state[32];
+struct pad_hz_config {
+    int args[MK_MAX_DEVICES];
+    unsigned int nargs;
 };
 
+static struct pad_hz_config pad_hz_cfg __initdata;
+
+module_param_array_named(pad_hz, pad_hz_cfg.args, int, &(pad_hz_cfg.nargs), 0);
+MODULE_PARM_DESC(pad_hz, "Polling rate in Hz of each Arcade Joystick, 0 for poll_hz");
+
+static int mk_debounce_mode = MK_DEBOUNCE_OFF;
+
+module_param_named(debounce, mk_debounce_mode, int, 0);
+MODULE_PARM_DESC(debounce, "Debounce polled pads : 0 off (default), 1 eager (report the first edge, then ignore the button for debounce_n polls), 2 deferred (report a change once stable for debounce_n polls)");
+
+static int mk_debounce_n = 3;
+
+module_param_named(debounce_n, mk_debounce_n, int, 0);
+MODULE_PARM_DESC(debounce_n, "Number of polls for debounce (1-7, default 3)");
+
+static bool mk_irq_mode;
+
+module_param_named(irq, mk_irq_mode, bool, 0);
+MODULE_PARM_DESC(irq, "Use GPIO edge interrupts instead of polling for GPIO, TFT and Custom Arcade Joystick");
+
+static bool mk_chardev;
+
+module_param_named(chardev, mk_chardev, bool, 0);
+MODULE_PARM_DESC(chardev, "Share the state of every pad through /dev/am_arcade, to read or mmap");
+
+static bool mk_msc_timestamp;
+
+module_param_named(msc_timestamp, mk_msc_timestamp, bool, 0);
+MODULE_PARM_DESC(msc_timestamp, "Also send the sample time of each report as a MSC_TIMESTAMP event, in us");
+
+static bool mk_latch;
+
+module_param_named(latch, mk_latch, bool, 0);
+MODULE_PARM_DESC(latch, "Catch the edges of polled GPIO, TFT and Custom Arcade Joystick pins between polls, so a press shorter than a poll is still reported");
+
+static int mk_gpio_base;
+
+module_param_named(gpiobase, mk_gpio_base, int, 0);
+MODULE_PARM_DESC(gpiobase, "Base of the SoC gpiochip in the gpio numbering, used to look up interrupts");
+
+static unsigned int mk_poll_hz = 100;
+
+module_param_named(poll_hz, mk_poll_hz, uint, 0);
+MODULE_PARM_DESC(poll_hz, "Polling rate in Hz (10-2000, default 100)");
+
+static unsigned long mk_overruns;
+
+module_param_named(overruns, mk_overruns, ulong, 0444);
+MODULE_PARM_DESC(overruns, "Number of poll periods missed because a tick fired late or ran too long");
+
+static unsigned int mk_mux_ns = 5000;
+
+module_param_named(mux_ns, mk_mux_ns, uint, 0);
+MODULE_PARM_DESC(mux_ns, "Settle time of the multiplexer after each address change, in ns (default 5000)");
+
+static bool mk_mux_paced;
+
+module_param_named(mux_paced, mk_mux_paced, bool, 0);
+MODULE_PARM_DESC(mux_paced, "Step the multiplexer scan from a timer instead of waiting out each settle time in the poll");
+
+static unsigned int mk_hc165_ns = 50;
+
+module_param_named(hc165_ns, mk_hc165_ns, uint, 0);
+MODULE_PARM_DESC(hc165_ns, "Width of the load and clock pulses of the 74HC165 chain, in ns (default 50)");
+
+static bool mk_hc165_spi;
+
+module_param_named(hc165_spi, mk_hc165_spi, bool, 0);
+MODULE_PARM_DESC(hc165_spi, "Shift the 74HC165 chain with the SPI0 controller : CLK on GPIO 11 (SCLK), data on GPIO 9 (MISO)");
+
+static unsigned int mk_hc165_spi_hz = 8000000;
+
+module_param_named(hc165_spi_hz, mk_hc165_spi_hz, uint, 0);
+MODULE_PARM_DESC(hc165_spi_hz, "Clock of the 74HC165 chain in SPI mode, in Hz (default 8000000)");
+
+static int mk_poll_cpu = -1;
+
+module_param_named(poll_cpu, mk_poll_cpu, int, 0);
+MODULE_PARM_DESC(poll_cpu, "Poll from a real-time thread bound to this CPU instead of a timer (-1, default, for the timer)");
+
+static int mk_poll_prio = 50;
+
+module_param_named(poll_prio, mk_poll_prio, int, 0);
+MODULE_PARM_DESC(poll_prio, "SCHED_FIFO priority of the polling thread (1-99, default 50)");
+
+static unsigned long mk_wakeup_max_ns;
+
+module_param_named(wakeup_max_ns, mk_wakeup_max_ns, ulong, 0444);
+MODULE_PARM_DESC(wakeup_max_ns, "Worst wakeup latency of the polling thread since it started, in ns");
+
+static unsigned long mk_wakeup_avg_ns;
+
+module_param_named(wakeup_avg_ns, mk_wakeup_avg_ns, ulong, 0444);
+MODULE_PARM_DESC(wakeup_avg_ns, "Average wakeup latency of the polling thread, in ns");
+
+static unsigned long mk_class_overruns[MK_MAX];
+
+module_param_array_named(class_overruns, mk_class_overruns, ulong, NULL, 0444);
+MODULE_PARM_DESC(class_overruns, "Number of pad polls missed or skipped, for each map type");
+
+
+#define MK_POLL_HZ_MIN	10
+#define MK_POLL_HZ_MAX	2000
+
 struct mk_nin_gpio {
     unsigned pad_id;
     unsigned cmd_setinputs;
@@ -145,22 +276,12 @@ struct mk_nin_gpio {
     unsigned response_bufsize;
 };
 
-struct mk {
-    struct mk_pad pads[MK_MAX_DEVICES];
-    struct timer_list timer;
-    int pad_count[MK_MAX];
-    int used;
-    struct mutex mutex;
-};
-
 struct mk_subdev {
     unsigned int idx;
 };
 
 static struct mk *mk_base;
 
-static const int mk_data_size = 32;
-
 static const int mk_max_arcade_buttons = 13;
 static const int mk_max_mcp_arcade_buttons = 16;
 static const int mk_max_mux_arcade_buttons = 16;
@@ -168,42 +289,22 @@ static const int mk_max_mux_arcade_buttons = 16;
 static int mk_current_arcade_buttons = 0;
 static int mk_uses_hotkey = 2; // 0 - unuse, 1 - hotkey, 2 - fn key
 
-// Map of the gpios :                           up, down, left, right, start, select, a,  b,  tr, y,  x,  tl  hk
-static const int mk_arcade_gpio_maps[]      = { 4,  17,    27,  22,    10,    9,      25, 24, 23, 18, 15, 14, 2 };
-// 2nd joystick on the b+ GPIOS                  up, down, left, right, start, select, a,  b,  tr, y,  x,  tl hk
-static const int mk_arcade_gpio_maps_bplus[] = { 11, 5,    6,    13,    19,    26,     21, 20, 16, 12, 7,  8, 3 };
-
-// Map of the mcp23017 on GPIOA                  up, down, left, right, start, select, a, b
-static const int mk_arcade_gpioa_maps[]      = { 0,  1,    2,    3,     4,     5,      6, 7 };
-// Map of the mcp23017 on GPIOB                  tr, y, x, tl, c, tr2, z, tl2
-static const int mk_arcade_gpiob_maps[]      = { 0,  1, 2, 3,  4, 5,   6, 7 };
-
-// Map joystick on the b+ GPIOS with TFT         up, down, left, right, start, select, a,  b, tr, y,  x,  tl
-static const int mk_arcade_gpio_maps_tft[]   = { 21, 13,   26,   19,    5,     6,      22, 4, 20, 17, 27, 16 };
-
 static const short mk_arcade_gpio_btn[] = {
 	BTN_START, BTN_SELECT, BTN_A, BTN_B, BTN_TR, BTN_Y, BTN_X, BTN_TL, BTN_C, BTN_TR2, BTN_Z, BTN_TL2, BTN_HOTKEY
 };
 
-static const short mk_arcade_btn[] = {
-	BTN_START, BTN_SELECT, BTN_A, BTN_B, BTN_TR, BTN_Y, BTN_X, BTN_TL, BTN_C, BTN_TR2, BTN_Z, BTN_TL2, 
-
-    BTN_MISC + 0, BTN_MISC + 1, BTN_MISC + 2, BTN_MISC + 3, BTN_MISC + 4, BTN_MISC + 5, BTN_MISC + 6, BTN_MISC + 7, 
-    BTN_MISC + 8, BTN_MISC + 9, BTN_MISC + 10, BTN_MISC + 11, BTN_MISC + 12, BTN_MISC + 13, BTN_MISC + 14, BTN_MISC + 15
-};
-
 static const char *mk_names[] = {
     NULL, "GPIO Controller 1", "GPIO Controller 2", "MCP23017 Controller", "GPIO Controller 1" , "GPIO Controller 1", "Multiplexer Controller", "74HC165 Controller"
 };
 
 /* GPIO UTILS */
 static void setGpioPullUps(int pullUps) {
-    *(gpio + 37) = 0x02;
+    mk_gpio_write(GPPUD, 0x02);
     udelay(10);
-    *(gpio + 38) = pullUps;
+    mk_gpio_write(GPPUDCLK0, pullUps);
     udelay(10);
-    *(gpio + 37) = 0x00;
-    *(gpio + 38) = 0x00;
+    mk_gpio_write(GPPUD, 0x00);
+    mk_gpio_write(GPPUDCLK0, 0x00);
 }
 
 static void setGpioAsInput(int gpioNum) {
@@ -228,185 +329,308 @@ static int getPullUpMask(int gpioMap[], int count){
 
 static void putGpioValue(int gpiono, int onoff) {
     if (onoff) 
-        GPIO_SET = (1 << gpiono); 
+        mk_gpio_write(GPSET0, 1 << gpiono);
     else
-        GPIO_CLR = (1 << gpiono);
+        mk_gpio_write(GPCLR0, 1 << gpiono);
 }
 
 
-/*  ------------------------------------------------------------------------------- */
+/*
+ * mk_gpio_latch_irq() samples a latching pad on any edge of its pins, see mk_gpio_latch_edge().
+ */
 
-static void mk_mcp23017_read_packet(struct mk_pad * pad, unsigned char *data) {
-    int i;
-    char resultA, resultB;
-    i2c_read(pad->mcp23017addr, MPC23017_GPIOA_READ, &resultA, 1);
-    i2c_read(pad->mcp23017addr, MPC23017_GPIOB_READ, &resultB, 1);
+static irqreturn_t mk_gpio_latch_irq(int irq, void *dev_id) {
+    mk_gpio_latch_edge(dev_id);
+    return IRQ_HANDLED;
+}
 
-    // read direction
-    for (i = 0; i < 4; i++) {
-        data[i] = !((resultA >> mk_arcade_gpioa_maps[i]) & 0x1);
-    }
-    // read buttons on gpioa
-    for (i = 4; i < 8; i++) {
-        data[i] = !((resultA >> mk_arcade_gpioa_maps[i]) & 0x1);
-    }
-    // read buttons on gpiob
-    for (i = 8; i < 16; i++) {
-        data[i] = !((resultB >> (mk_arcade_gpiob_maps[i-8])) & 0x1);
-    }
+/*
+ * mk_gpio_irq() reads and reports a pad in interrupt mode, on any edge of its pins.
+ */
+
+static irqreturn_t mk_gpio_irq(int irq, void *dev_id) {
+    mk_gpio_irq_report(dev_id);
+    return IRQ_HANDLED;
 }
 
-static void mk_gpio_read_packet(struct mk_pad * pad, unsigned char *data) {
-    int i;
+/*
+ * mk_mcp23017_hardirq() records when the INT line of a MCP23017 pad was asserted, then
+ * mk_mcp23017_irq() reads and reports the pad from its thread.
+ */
 
-    for (i = 0; i < mk_current_arcade_buttons; i++) {
-        if(pad->gpio_maps[i] != -1){    // to avoid unused buttons
-            int read = GPIO_READ(pad->gpio_maps[i]);
-            if (read == 0) data[i] = 1;
-            else data[i] = 0;
-        }else data[i] = 0;
-    }
+static irqreturn_t mk_mcp23017_hardirq(int irq, void *dev_id) {
+    struct mk_pad *pad = dev_id;
+
+    // the line stays masked until the thread is done, so this is not overwritten before it runs
+    pad->irq_time = ktime_get();
+    return IRQ_WAKE_THREAD;
 }
 
-static void mk_multiplexer_read_packet(struct mk_pad * pad, unsigned char *data) {
-    int i, value;
-    int addr0 = pad->gpio_maps[0];
-    int addr1 = pad->gpio_maps[1];
-    int addr2 = pad->gpio_maps[2];
-    int addr3 = pad->gpio_maps[3];
-    int readp = pad->gpio_maps[4];
-    int startoffs = pad->start_offs;
-    int loopcount = pad->button_count;
+static irqreturn_t mk_mcp23017_irq(int irq, void *dev_id) {
+    struct mk_pad *pad = dev_id;
+    struct mk *mk = input_get_drvdata(pad->dev);
+    ktime_t start = pad->irq_time, sampled;
+    u32 captured, current;
+    int err;
 
-    for (i = 0; i < loopcount; i++) {
-        int addr = i + startoffs;
-        putGpioValue(addr0, addr & 1);
-        putGpioValue(addr1, (addr >> 1) & 1);
-        putGpioValue(addr2, (addr >> 2) & 1);
-        putGpioValue(addr3, (addr >> 3) & 1);
-        udelay(5);
-        value = GET_GPIO(readp);
-        data[i] = (value == 0)? 1 : 0;
-    }
-    for (i = loopcount; i < mk_current_arcade_buttons; i++) {
-        data[i] = (value == 0)? 1 : 0;
+    err = mk_mcp23017_read_intcap(pad, &captured, &current);
+    sampled = ktime_get();
+    mutex_lock(&mk->irq_mutex);
+    mk_stats_i2c(pad, err);
+    if (err) {
+        mutex_unlock(&mk->irq_mutex);
+        return IRQ_HANDLED;
     }
+    mk_stats_sample(pad, start);
+
+    // report the state captured at the change first, so a press released before the read is not lost.
+    // INTCAP is latched on the edge that raised the interrupt, stamped by the hard handler, GPIO during the read
+    mk_input_report(pad, captured, start);
+    mk_input_report(pad, current, sampled);
+    mutex_unlock(&mk->irq_mutex);
+
+    return IRQ_HANDLED;
 }
 
-static void mk_74hc165_read_packet(struct mk_pad * pad, unsigned char *data) {
-    int i, idx, value;
-    int ld = pad->gpio_maps[0];
-    int cl = pad->gpio_maps[1];
-    int readp = pad->gpio_maps[2];
-    int startoffs = pad->start_offs;
-    int loopcount = pad->button_count;
+/*
+ * mk_timer() initiates reads of console pads data.
+ */
 
-    putGpioValue(ld, 0);
-    udelay(5);
-    putGpioValue(ld, 1);
-    idx = 0;
-    for (i = 0; i < startoffs; i++) {
-        value = GET_GPIO(readp);
-    }
-    for (i = 0; i < loopcount; i++) {
-        value = GET_GPIO(readp);
-        data[i] = (value == 0)? 1 : 0;
-    }
-    for (i = loopcount; i < mk_current_arcade_buttons; i++) {
-        data[i] = (value == 0)? 1 : 0;
-    }
+static enum hrtimer_restart mk_timer(struct hrtimer *t) {
+    struct mk *mk = container_of(t, struct mk, timer);
+    u64 missed;
+
+    mk_process_packet(mk, hrtimer_get_expires(t));
+
+    // deadlines stay on the period grid; skipped periods are counted as overruns
+    missed = hrtimer_forward_now(t, mk->period);
+    if (missed > 1)
+        mk_overruns += missed - 1;
+    return HRTIMER_RESTART;
 }
 
-static void mk_input_report(struct mk_pad * pad, unsigned char * data) {
-    struct input_dev * dev = pad->dev;
-    int j;
-    
-    input_report_abs(dev, ABS_Y, !data[0]-!data[1]);
-    input_report_abs(dev, ABS_X, !data[2]-!data[3]);
-    for (j = 4; j < mk_current_arcade_buttons; j++) {
-        input_report_key(dev, mk_arcade_btn[j - 4], data[j]);
+/*
+ * mk_poll_thread() runs the same polling loop as mk_timer() when poll_cpu is set.
+ */
+
+static int mk_poll_thread(void *data) {
+    struct mk *mk = data;
+    ktime_t deadline = ktime_get();
+    s64 late, missed;
+
+    mk_wakeup_max_ns = 0;
+    mk_wakeup_avg_ns = 0;
+
+    while (!kthread_should_stop()) {
+        deadline = ktime_add(deadline, mk->period);
+        set_current_state(TASK_INTERRUPTIBLE);
+        if (!kthread_should_stop())
+            schedule_hrtimeout_range(&deadline, 0, HRTIMER_MODE_ABS);
+        __set_current_state(TASK_RUNNING);
+        if (kthread_should_stop())
+            break;
+
+        late = ktime_to_ns(ktime_sub(ktime_get(), deadline));
+        if (late < 0)
+            late = 0;
+        if (late > mk_wakeup_max_ns)
+            mk_wakeup_max_ns = late;
+        mk_wakeup_avg_ns += ((long)late - (long)mk_wakeup_avg_ns) / 16;
+
+        mk_process_packet(mk, deadline);
+
+        // deadlines stay on the period grid; skipped periods are counted as overruns
+        missed = ktime_divns(ktime_sub(ktime_get(), deadline), ktime_to_ns(mk->period));
+        if (missed > 0) {
+            mk_overruns += missed;
+            deadline = ktime_add_ns(deadline, missed * ktime_to_ns(mk->period));
+        }
     }
-    input_sync(dev);
+    return 0;
+}
+
+static int mk_start_poll_thread(struct mk *mk) {
+    struct task_struct *thread;
+#ifdef HAVE_SCHED_SETATTR
+    struct sched_attr attr = {
+        .size = sizeof(attr),
+        .sched_policy = SCHED_FIFO,
+        .sched_priority = clamp(mk_poll_prio, 1, MAX_RT_PRIO - 1),
+    };
+#else
+    struct sched_param param = {
+        .sched_priority = clamp(mk_poll_prio, 1, MAX_RT_PRIO - 1),
+    };
+#endif
 
-    for(j = 0; j < mk_current_arcade_buttons; j++)
-        pad->current_button_state[i] = data[i];
+    thread = kthread_create(mk_poll_thread, mk, "mk_poll/%d", mk_poll_cpu);
+    if (IS_ERR(thread))
+        return PTR_ERR(thread);
+
+    kthread_bind(thread, mk_poll_cpu);
+#ifdef HAVE_SCHED_SETATTR
+    sched_setattr_nocheck(thread, &attr);
+#else
+    sched_setscheduler_nocheck(thread, SCHED_FIFO, &param);
+#endif
+    mk->thread = thread;
+    wake_up_process(thread);
+    return 0;
 }
 
-static void mk_process_packet(struct mk *mk) {
+// Start sampling the polled pads, from the polling thread if poll_cpu is set, else from the timer.
+static void mk_start_polling(struct mk *mk) {
+    int i;
 
-    unsigned char data[mk_data_size];
-    struct mk_pad *pad;
-    int i, j;
+    for (i = 0; i < MK_MAX_DEVICES; i++)
+        mk->pads[i].next_due = 0;
 
-    for (i = 0; i < MK_MAX_DEVICES; i++) {
-        pad = &mk->pads[i];
-        if (pad->type == MK_ARCADE_GPIO || pad->type == MK_ARCADE_GPIO_BPLUS || pad->type == MK_ARCADE_GPIO_TFT || pad->type == MK_ARCADE_GPIO_CUSTOM) {
-            mk_gpio_read_packet(pad, data);
-            //mk_input_report(pad, data);
-        } else if (pad->type == MK_ARCADE_MCP23017) {
-            mk_mcp23017_read_packet(pad, data);
-            //mk_input_report(pad, data);
-        } else if (pad->type == MK_ARCADE_GPIO_MULTIPLEXER) {
-            mk_multiplexer_read_packet(pad, data);
-            //mk_input_report(pad, data);
-        } else if (pad->type == MK_ARCADE_GPIO_74HC165) {
-            mk_74hc165_read_packet(pad, data);
-            //mk_input_report(pad, data);
-        } else {
-            continue;
-        }
+    if (mk_poll_cpu >= 0 && !mk_start_poll_thread(mk))
+        return;
+    hrtimer_start(&mk->timer, ktime_add(ktime_get(), mk->period), MK_HRTIMER_MODE);
+}
 
-        mk_input_report(pad, data);
+static void mk_stop_polling(struct mk *mk) {
+    if (mk->thread) {
+        kthread_stop(mk->thread);
+        mk->thread = NULL;
+    } else {
+        hrtimer_cancel(&mk->timer);
     }
-
+    hrtimer_cancel(&mk->mux_timer);
+    mk->mux_busy = false;
 }
 
-/*
- * mk_timer() initiates reads of console pads data.
- */
+static struct mk_pad *mk_dev_pad(struct mk *mk, struct input_dev *dev) {
+    int i;
 
-#ifdef HAVE_TIMER_SETUP
-static void mk_timer(struct timer_list *t) {
-    struct mk *mk = from_timer(mk, t, timer);
-#else
-static void mk_timer(unsigned long private) {
-    struct mk *mk = (void *) private;
-#endif    
-    mk_process_packet(mk);
-    mod_timer(&mk->timer, jiffies + MK_REFRESH_TIME);
+    for (i = 0; i < MK_MAX_DEVICES; i++)
+        if (mk->pads[i].dev == dev)
+            return &mk->pads[i];
+    return NULL;
 }
 
+// Each pad is polled only while its input device is open, polling stops with the last one.
 static int mk_open(struct input_dev *dev) {
     struct mk *mk = input_get_drvdata(dev);
+    struct mk_pad *pad = mk_dev_pad(mk, dev);
+    u32 state;
     int err;
 
     err = mutex_lock_interruptible(&mk->mutex);
     if (err)
         return err;
 
-    if (!mk->used++)
-        mod_timer(&mk->timer, jiffies + MK_REFRESH_TIME);
+    if (mk_pad_polled(pad)) {
+        // a pad opened while the others are polled starts on its own period grid,
+        // without the edges its pins latched while it was closed
+        pad->next_due = 0;
+        atomic_set(&pad->seen_on, 0);
+        atomic_set(&pad->seen_off, 0);
+        smp_store_release(&pad->open, true);
+        if (!mk->poll_used++)
+            mk_start_polling(mk);
+    }
 
     mutex_unlock(&mk->mutex);
+
+    // interrupt mode pads only report on changes, so start from the current state
+    if (mk_pad_polled(pad))
+        return 0;
+    if (pad->type == MK_ARCADE_MCP23017) {
+        state = mk_mcp23017_read_packet(pad);
+    } else {
+        state = mk_gpio_read_packet(pad, GPIO_LEV0);
+    }
+    mutex_lock(&mk->irq_mutex);
+    mk_input_report(pad, state, ktime_get());
+    mutex_unlock(&mk->irq_mutex);
     return 0;
 }
 
 static void mk_close(struct input_dev *dev) {
     struct mk *mk = input_get_drvdata(dev);
+    struct mk_pad *pad = mk_dev_pad(mk, dev);
 
     mutex_lock(&mk->mutex);
-    if (!--mk->used) {
-        del_timer_sync(&mk->timer);
+    if (mk_pad_polled(pad)) {
+        WRITE_ONCE(pad->open, false);
+        if (!--mk->poll_used)
+            mk_stop_polling(mk);
+        // the device may go away once closed, so wait for a read of it still on the bus,
+        // or for a paced scan that is about to report it
+        if (pad->type == MK_ARCADE_MCP23017) {
+            bsc_cancel(&pad->xfer);
+        } else if (pad->type == MK_ARCADE_GPIO_MULTIPLEXER) {
+            // a scan stopped halfway never clears mux_busy itself
+            if (hrtimer_cancel(&mk->mux_timer))
+                smp_store_release(&mk->mux_busy, false);
+        }
     }
     mutex_unlock(&mk->mutex);
 }
 
+static void mk_free_pad_irqs(struct mk_pad *pad) {
+    while (pad->irq_count > 0)
+        free_irq(pad->irqs[--pad->irq_count], pad);
+}
+
+// Request both-edge interrupts on all the pins of a direct GPIO pad.
+static int __init mk_setup_pad_irqs(struct mk_pad *pad) {
+    int i, irq, err;
+
+    for (i = 0; i < mk_max_arcade_buttons; i++) {
+        if (!(pad->button_mask & (1 << i)))
+            continue;
+
+        irq = gpio_to_irq(mk_gpio_base + pad->gpio_shift[i]);
+        if (irq < 0) {
+            err = irq;
+            goto err_free_irqs;
+        }
+        if (pad->latch)
+            err = request_irq(irq, mk_gpio_latch_irq, IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING,
+                    KBUILD_MODNAME, pad);
+        else
+            err = request_threaded_irq(irq, NULL, mk_gpio_irq,
+                    IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING | IRQF_ONESHOT,
+                    KBUILD_MODNAME, pad);
+        if (err)
+            goto err_free_irqs;
+
+        pad->irqs[pad->irq_count++] = irq;
+    }
+    return 0;
+
+err_free_irqs:
+    mk_free_pad_irqs(pad);
+    return err;
+}
+
+// Request the interrupt of the GPIO wired to the INT line of a MCP23017 pad.
+static int __init mk_setup_mcp23017_irq(struct mk_pad *pad, int int_gpio) {
+    int irq, err;
+
+    irq = gpio_to_irq(mk_gpio_base + int_gpio);
+    if (irq < 0)
+        return irq;
+    // INT stays asserted until INTCAP or GPIO is read, so trigger on the level
+    err = request_threaded_irq(irq, mk_mcp23017_hardirq, mk_mcp23017_irq, IRQF_TRIGGER_LOW | IRQF_ONESHOT,
+            KBUILD_MODNAME, pad);
+    if (err)
+        return err;
+
+    pad->irqs[pad->irq_count++] = irq;
+    return 0;
+}
+
 static int __init mk_setup_pad(struct mk *mk, int idx, int pad_type_arg) {
     struct mk_pad *pad = &mk->pads[idx];
     struct input_dev *input_dev;
-    int i, pad_type;
+    int i, pad_type, ext;
     int err;
-    char FF = 0xFF;
+    int int_gpio = -1;
+    unsigned int hz;
     pr_err("pad type : %d\n",pad_type_arg);
 
     if (pad_type_arg >= MK_MAX) {
@@ -434,8 +658,8 @@ static int __init mk_setup_pad(struct mk *mk, int idx, int pad_type_arg) {
         if (gpio_cfg.nargs < 1) {
             pr_err("Multiplexer device needs gpio argument\n");
             return -EINVAL;
-        } else if(gpio_cfg.nargs != 5){
-             pr_err("Invalid gpio argument\n", pad_type);
+        } else if(gpio_cfg.nargs < 5 + mk->pad_count[pad_type]){
+             pr_err("Invalid gpio argument, each multiplexer needs its read gpio\n");
              return -EINVAL;
         }
     } else if (pad_type == MK_ARCADE_GPIO_74HC165) {
@@ -456,6 +680,7 @@ static int __init mk_setup_pad(struct mk *mk, int idx, int pad_type_arg) {
         return -ENOMEM;
     }
 
+    pad->idx = idx;
     pad->type = pad_type;
     pad->mcp23017addr = pad_type_arg;
     snprintf(pad->phys, sizeof (pad->phys),
@@ -474,6 +699,8 @@ static int __init mk_setup_pad(struct mk *mk, int idx, int pad_type_arg) {
     input_dev->close = mk_close;
 
     input_dev->evbit[0] = BIT_MASK(EV_KEY) | BIT_MASK(EV_ABS);
+    if (mk_msc_timestamp)
+        input_set_capability(input_dev, EV_MSC, MSC_TIMESTAMP);
 
     for (i = 0; i < 2; i++) {
         input_set_abs_params(input_dev, ABS_X + i, -1, 1, 0, 0);
@@ -508,51 +735,69 @@ static int __init mk_setup_pad(struct mk *mk, int idx, int pad_type_arg) {
             break;
         case MK_ARCADE_MCP23017:
             // nothing to asign if MCP23017 is used
+            pad->button_mask = MK_STATE_MASK(mk_max_mcp_arcade_buttons);
+            mk_mcp23017_setup_xfer(pad, mk_mcp23017_complete);
             break;
         case MK_ARCADE_GPIO_MULTIPLEXER:
-            memcpy(pad->gpio_maps, gpio_cfg.mk_arcade_gpio_maps_custom, 5 *sizeof(int));
+            // the multiplexers share the 4 address lines, the nth one reads on the (5 + n)th gpio
+            // and takes the nth start/count pair of ext
+            ext = mk->pad_count[pad_type] - 1;
+            memcpy(pad->gpio_maps, gpio_cfg.mk_arcade_gpio_maps_custom, 4 *sizeof(int));
+            pad->gpio_maps[4] = gpio_cfg.mk_arcade_gpio_maps_custom[4 + ext];
+            ext *= 2;
             pad->start_offs = 0;
             pad->button_count = mk_current_arcade_buttons;
-            if (ext_cfg.nargs >= 1) {
-                pad->start_offs = ext_cfg.args[0];
-                if (ext_cfg.nargs >= 2) {
-                    pad->button_count = ext_cfg.args[1];
+            if (ext_cfg.nargs >= ext + 1) {
+                pad->start_offs = ext_cfg.args[ext];
+                if (ext_cfg.nargs >= ext + 2) {
+                    pad->button_count = ext_cfg.args[ext + 1];
                 }
             }
+            // 4 address lines, so 16 channels
+            pad->start_offs = clamp(pad->start_offs, 0, 15);
+            pad->button_count = clamp(pad->button_count, 0, 16 - pad->start_offs);
+            pad->button_mask = MK_STATE_MASK(pad->button_count);
+            if (mk->pad_count[pad_type] == 1 || pad->start_offs < mk->mux_start)
+                mk->mux_start = pad->start_offs;
+            mk->mux_end = max(mk->mux_end, pad->start_offs + pad->button_count);
             break;
         case MK_ARCADE_GPIO_74HC165:
             memcpy(pad->gpio_maps, gpio_cfg.mk_arcade_gpio_maps_custom, 3 *sizeof(int));
+            // the pads share one chain : the nth 74HC165 pad takes the nth start/count pair of ext
+            ext = 2 * (mk->pad_count[pad_type] - 1);
             pad->start_offs = 0;
             pad->button_count = mk_current_arcade_buttons;
-            if (ext_cfg.nargs >= 1) {
-                pad->start_offs = ext_cfg.args[0];
-                if (ext_cfg.nargs >= 2) {
-                    pad->button_count = ext_cfg.args[1];
+            if (ext_cfg.nargs >= ext + 1) {
+                pad->start_offs = ext_cfg.args[ext];
+                if (ext_cfg.nargs >= ext + 2) {
+                    pad->button_count = ext_cfg.args[ext + 1];
                 }
             }
+            pad->start_offs = clamp(pad->start_offs, 0, 32);
+            pad->button_count = clamp(pad->button_count, 0, 32);
+            pad->button_mask = MK_STATE_MASK(pad->button_count);
+            mk->hc165_bits = max(mk->hc165_bits, pad->start_offs + pad->button_count);
             break;
     }
 
+    // chains and multiplexers may have more buttons than the common layout registered above,
+    // the ones past it are reported as BTN_MISC + n
+    if (pad_type == MK_ARCADE_GPIO_MULTIPLEXER || pad_type == MK_ARCADE_GPIO_74HC165) {
+        for (i = 0; i < pad->button_count - MK_STATE_BTN_SHIFT && i < ARRAY_SIZE(mk_arcade_btn); i++)
+            __set_bit(mk_arcade_btn[i], input_dev->keybit);
+    }
+
     // initialize gpio if not MCP23017, else initialize i2c
     if(pad_type == MK_ARCADE_MCP23017){
         i2c_init();
         udelay(1000);
-        // Put all GPIOA inputs on MCP23017 in INPUT mode
-        i2c_write(pad->mcp23017addr, MPC23017_GPIOA_MODE, &FF, 1);
-        udelay(1000);
-        // Put all inputs on MCP23017 in pullup mode
-        i2c_write(pad->mcp23017addr, MPC23017_GPIOA_PULLUPS_MODE, &FF, 1);
-        udelay(1000);
-        // Put all GPIOB inputs on MCP23017 in INPUT mode
-        i2c_write(pad->mcp23017addr, MPC23017_GPIOB_MODE, &FF, 1);
-        udelay(1000);
-        // Put all inputs on MCP23017 in pullup mode
-        i2c_write(pad->mcp23017addr, MPC23017_GPIOB_PULLUPS_MODE, &FF, 1);
-        udelay(1000);
-        // Put all inputs on MCP23017 in pullup mode a second time
-        // Known bug : if you remove this line, you will not have pullups on GPIOB 
-        i2c_write(pad->mcp23017addr, MPC23017_GPIOB_PULLUPS_MODE, &FF, 1);
-        udelay(1000);
+        if (idx < mcp_int_cfg.nargs && mcp_int_cfg.args[idx] >= 0 && mcp_int_cfg.args[idx] < 32)
+            int_gpio = mcp_int_cfg.args[idx];
+        mk_mcp23017_setup(pad, int_gpio >= 0);
+        if (int_gpio >= 0) {
+            setGpioAsInput(int_gpio);
+            setGpioPullUps(1 << int_gpio);
+        }
     } else if(pad_type == MK_ARCADE_GPIO_MULTIPLEXER) {
         for (i = 0; i < 5; i++) {
             printk("GPIO = %d\n", pad->gpio_maps[i]);
@@ -563,15 +808,27 @@ static int __init mk_setup_pad(struct mk *mk, int idx, int pad_type_arg) {
         setGpioAsOutput(pad->gpio_maps[3]);
         setGpioAsInput(pad->gpio_maps[4]);
         setGpioPullUps(getPullUpMask(&pad->gpio_maps[4], 1));
+        mk_setup_mux_table(mk, pad);
         printk("GPIO configured for pad%d\n", idx);
     } else if(pad_type == MK_ARCADE_GPIO_74HC165) {
         for (i = 0; i < 3; i++) {
             printk("GPIO = %d\n", pad->gpio_maps[i]);
         }
         setGpioAsOutput(pad->gpio_maps[0]);
-        setGpioAsOutput(pad->gpio_maps[1]);
-        setGpioAsInput(pad->gpio_maps[2]);
-        setGpioPullUps(getPullUpMask(&pad->gpio_maps[2], 1));
+        // LD idles high between two reads of the chain
+        putGpioValue(pad->gpio_maps[0], 1);
+        if (mk_hc165_spi) {
+            // CLK and data are on the SPI0 pins, whatever the gpio argument says
+            if (pad->gpio_maps[1] != SPI0_SCLK_GPIO || pad->gpio_maps[2] != SPI0_MISO_GPIO)
+                pr_err("74HC165 in SPI mode : CLK is on GPIO %d and data on GPIO %d\n", SPI0_SCLK_GPIO, SPI0_MISO_GPIO);
+            mk_74hc165_spi_init(mk_hc165_spi_hz);
+        } else {
+            setGpioAsOutput(pad->gpio_maps[1]);
+            setGpioAsInput(pad->gpio_maps[2]);
+            setGpioPullUps(getPullUpMask(&pad->gpio_maps[2], 1));
+            // CLK idles low
+            putGpioValue(pad->gpio_maps[1], 0);
+        }
         printk("GPIO configured for pad%d\n", idx);
     } else {
         for (i = 0; i < mk_max_arcade_buttons; i++) {
@@ -581,6 +838,7 @@ static int __init mk_setup_pad(struct mk *mk, int idx, int pad_type_arg) {
             }                
         }
         setGpioPullUps(getPullUpMask(pad->gpio_maps, 12));
+        mk_setup_gpio_table(pad, mk_max_arcade_buttons);
         printk("GPIO configured for pad%d\n", idx);
 	}
 
@@ -588,6 +846,34 @@ static int __init mk_setup_pad(struct mk *mk, int idx, int pad_type_arg) {
     if (err)
         goto err_free_dev;
 
+    // GPIO pads may be driven by edge interrupts, or latch their edges between polls,
+    // every other backend is polled
+    if ((mk_irq_mode || mk_latch) && pad->button_mask && (pad_type == MK_ARCADE_GPIO || pad_type == MK_ARCADE_GPIO_BPLUS ||
+            pad_type == MK_ARCADE_GPIO_TFT || pad_type == MK_ARCADE_GPIO_CUSTOM)) {
+        pad->latch = !mk_irq_mode;
+        err = mk_setup_pad_irqs(pad);
+        if (err) {
+            pr_err("No interrupts for pad%d (%d), polling it\n", idx, err);
+            pad->latch = false;
+        }
+    } else if (int_gpio >= 0) {
+        err = mk_setup_mcp23017_irq(pad, int_gpio);
+        if (err)
+            pr_err("No interrupt on GPIO %d for pad%d (%d), polling it\n", int_gpio, idx, err);
+    }
+    if (mk_pad_polled(pad)) {
+        // the poll tick runs at the rate of the fastest polled pad
+        hz = mk_poll_hz;
+        if (idx < pad_hz_cfg.nargs && pad_hz_cfg.args[idx] > 0)
+            hz = pad_hz_cfg.args[idx];
+        pad->period = ktime_set(0, NSEC_PER_SEC / clamp_val(hz, MK_POLL_HZ_MIN, MK_POLL_HZ_MAX));
+        if (!mk->period || ktime_before(pad->period, mk->period))
+            mk->period = pad->period;
+        if (pad->type == MK_ARCADE_GPIO_MULTIPLEXER && mk_mux_paced &&
+                (u64)mk->mux_steps * mk_mux_ns >= ktime_to_ns(pad->period))
+            pr_warn("A paced scan of pad%d takes longer than its poll period, every other scan will be skipped\n", idx);
+    }
+
     return 0;
 
 err_free_dev:
@@ -609,11 +895,26 @@ static struct mk __init *mk_probe(int *pads, int n_pads) {
         goto err_out;
     }
 
+    mk->cfg = (struct mk_poll_cfg) {
+        .debounce_mode = mk_debounce_mode,
+        .debounce_n = mk_debounce_n,
+        .mux_ns = mk_mux_ns,
+        .mux_paced = mk_mux_paced,
+        .hc165_ns = mk_hc165_ns,
+        .hc165_spi = mk_hc165_spi,
+        .msc_timestamp = mk_msc_timestamp,
+    };
+    mk->class_overruns = mk_class_overruns;
     mutex_init(&mk->mutex);
-#ifdef HAVE_TIMER_SETUP
-    timer_setup(&mk->timer, mk_timer, 0);
-#else    
-    setup_timer(&mk->timer, mk_timer, (long) mk);
+    mutex_init(&mk->irq_mutex);
+#ifdef HAVE_HRTIMER_SETUP
+    hrtimer_setup(&mk->timer, mk_timer, CLOCK_MONOTONIC, MK_HRTIMER_MODE);
+    hrtimer_setup(&mk->mux_timer, mk_mux_timer, CLOCK_MONOTONIC, MK_HRTIMER_MODE_REL);
+#else
+    hrtimer_init(&mk->timer, CLOCK_MONOTONIC, MK_HRTIMER_MODE);
+    mk->timer.function = mk_timer;
+    hrtimer_init(&mk->mux_timer, CLOCK_MONOTONIC, MK_HRTIMER_MODE_REL);
+    mk->mux_timer.function = mk_mux_timer;
 #endif
 
     for (i = 0; i < n_pads && i < MK_MAX_DEVICES; i++) {
@@ -637,9 +938,12 @@ static struct mk __init *mk_probe(int *pads, int n_pads) {
 
 err_unreg_devs:
     while (--i >= 0)
-        if (mk->pads[i].dev)
+        if (mk->pads[i].dev) {
+            mk_free_pad_irqs(&mk->pads[i]);
             input_unregister_device(mk->pads[i].dev);
+        }
 err_free_mk:
+    bsc_exit();
     kfree(mk);
 err_out:
     return ERR_PTR(err);
@@ -648,12 +952,270 @@ err_out:
 static void mk_remove(struct mk *mk) {
     int i;
 
+    // nothing queues I2C reads once the interrupts are freed, and closing the
+    // last polled pad stops the polling and waits for its reads
+    for (i = 0; i < MK_MAX_DEVICES; i++)
+        if (mk->pads[i].dev)
+            mk_free_pad_irqs(&mk->pads[i]);
     for (i = 0; i < MK_MAX_DEVICES; i++)
         if (mk->pads[i].dev)
             input_unregister_device(mk->pads[i].dev);
+    bsc_exit();
     kfree(mk);
 }
 
+/* DEBUGFS */
+
+static const char *mk_type_names[] = {
+    "none", "gpio", "gpio_bplus", "mcp23017", "gpio_tft", "gpio_custom", "multiplexer", "74hc165"
+};
+
+static struct dentry *mk_debugfs_dir;
+
+// Show the sum over the CPUs of one set of counters
+static void mk_stats_show_line(struct seq_file *m, const char *name, const struct mk_stats __percpu *stats) {
+    struct mk_stats sum = {0};
+    const struct mk_stats *s;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        s = per_cpu_ptr(stats, cpu);
+        sum.samples += s->samples;
+        sum.events += s->events;
+        sum.i2c_xfers += s->i2c_xfers;
+        sum.errors += s->errors;
+    }
+    seq_printf(m, "%-12s %12lu %12lu %12lu %12lu\n", name,
+            sum.samples, sum.events, sum.i2c_xfers, sum.errors);
+}
+
+static int mk_stats_show(struct seq_file *m, void *v) {
+    char name[16];
+    int i;
+
+    seq_printf(m, "%-12s %12s %12s %12s %12s\n", "", "samples", "events", "i2c_xfers", "errors");
+    for (i = 0; i < MK_MAX_DEVICES; i++) {
+        if (mk_base->pads[i].type == MK_NONE)
+            continue;
+        snprintf(name, sizeof(name), "pad%d", i);
+        mk_stats_show_line(m, name, &mk_cpu_stats.pads[i]);
+    }
+    for (i = 1; i < MK_MAX; i++)
+        if (mk_base->pad_count[i])
+            mk_stats_show_line(m, mk_type_names[i], &mk_cpu_stats.types[i]);
+    seq_printf(m, "overruns %lu\n", mk_overruns);
+    return 0;
+}
+
+static void mk_hist_show(struct seq_file *m, const char *name, const unsigned long __percpu *hist) {
+    unsigned long sum[MK_HIST_BUCKETS] = {0};
+    const unsigned long *h;
+    int cpu, i;
+
+    for_each_possible_cpu(cpu) {
+        h = per_cpu_ptr(hist, cpu);
+        for (i = 0; i < MK_HIST_BUCKETS; i++)
+            sum[i] += h[i];
+    }
+    seq_printf(m, "%s\n", name);
+    for (i = 0; i < MK_HIST_BUCKETS; i++)
+        if (sum[i])
+            seq_printf(m, "  >= %8lu ns %12lu\n", i ? 1UL << i : 0, sum[i]);
+}
+
+static int mk_hist_show_all(struct seq_file *m, void *v) {
+    char name[32];
+    int i;
+
+    mk_hist_show(m, "tick", mk_cpu_stats.tick_hist);
+    mk_hist_show(m, "late", mk_cpu_stats.late_hist);
+    for (i = 1; i < MK_MAX; i++) {
+        if (!mk_base->pad_count[i])
+            continue;
+        snprintf(name, sizeof(name), "read %s", mk_type_names[i]);
+        mk_hist_show(m, name, mk_cpu_stats.read_hist[i]);
+    }
+    return 0;
+}
+
+static int mk_stats_open(struct inode *inode, struct file *file) {
+    return single_open(file, mk_stats_show, inode->i_private);
+}
+
+static int mk_hist_open(struct inode *inode, struct file *file) {
+    return single_open(file, mk_hist_show_all, inode->i_private);
+}
+
+static const struct file_operations mk_stats_fops = {
+    .owner = THIS_MODULE,
+    .open = mk_stats_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+static const struct file_operations mk_hist_fops = {
+    .owner = THIS_MODULE,
+    .open = mk_hist_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+// Failures are not fatal, the statistics are only for debugging
+static void mk_debugfs_init(void) {
+    mk_debugfs_dir = debugfs_create_dir(KBUILD_MODNAME, NULL);
+    debugfs_create_file("stats", 0444, mk_debugfs_dir, NULL, &mk_stats_fops);
+    debugfs_create_file("histograms", 0444, mk_debugfs_dir, NULL, &mk_hist_fops);
+}
+
+/* CHARACTER DEVICE */
+
+/*
+ * /dev/am_arcade shares the state of every pad with userspace, as a read-only page to
+ * mmap or with read(). seq is odd while the page is being updated : readers of the mapping
+ * retry as with a seqlock. read() and poll() wait for a change since the last read().
+ */
+
+struct mk_state_page {
+    __u32 seq;
+    __u32 pad_count;
+    __u64 time_ns[MK_MAX_DEVICES];  // CLOCK_MONOTONIC time of the sample with the last change of each pad
+    __u32 state[MK_MAX_DEVICES];    // packed state, as reported : bit 0 up, 1 down, 2 left, 3 right, then the buttons
+};
+
+static struct mk_state_page *mk_state_page;
+static DEFINE_SPINLOCK(mk_state_lock);
+static DECLARE_WAIT_QUEUE_HEAD(mk_state_wait);
+
+static void mk_cdev_update(struct mk_pad * pad, u32 state, ktime_t sampled) {
+    struct mk_state_page *page;
+    unsigned long flags;
+
+    if (!READ_ONCE(mk_state_page))
+        return;
+
+    spin_lock_irqsave(&mk_state_lock, flags);
+    page = mk_state_page;
+    if (page) {
+        WRITE_ONCE(page->seq, page->seq + 1);
+        smp_wmb();
+        page->time_ns[pad->idx] = ktime_to_ns(sampled);
+        page->state[pad->idx] = state;
+        smp_wmb();
+        WRITE_ONCE(page->seq, page->seq + 1);
+    }
+    spin_unlock_irqrestore(&mk_state_lock, flags);
+    wake_up_interruptible(&mk_state_wait);
+}
+
+// The last seq read() returned is kept in private_data
+static bool mk_cdev_changed(struct file *file) {
+    return READ_ONCE(mk_state_page->seq) != (u32)(unsigned long)file->private_data;
+}
+
+static int mk_cdev_open(struct inode *inode, struct file *file) {
+    // an odd seq never matches, so the first read() returns at once
+    file->private_data = (void *)(unsigned long)(READ_ONCE(mk_state_page->seq) | 1);
+    return 0;
+}
+
+static ssize_t mk_cdev_read(struct file *file, char __user *buf, size_t count, loff_t *ppos) {
+    struct mk_state_page copy;
+    int err;
+
+    if (count < sizeof(copy))
+        return -EINVAL;
+
+    if (file->f_flags & O_NONBLOCK) {
+        if (!mk_cdev_changed(file))
+            return -EAGAIN;
+    } else {
+        err = wait_event_interruptible(mk_state_wait, mk_cdev_changed(file));
+        if (err)
+            return err;
+    }
+
+    spin_lock_irq(&mk_state_lock);
+    copy = *mk_state_page;
+    spin_unlock_irq(&mk_state_lock);
+    file->private_data = (void *)(unsigned long)copy.seq;
+
+    if (copy_to_user(buf, &copy, sizeof(copy)))
+        return -EFAULT;
+    return sizeof(copy);
+}
+
+static __poll_t mk_cdev_poll(struct file *file, poll_table *wait) {
+    poll_wait(file, &mk_state_wait, wait);
+    return mk_cdev_changed(file) ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
+static int mk_cdev_mmap(struct file *file, struct vm_area_struct *vma) {
+    if (vma->vm_pgoff || vma->vm_end - vma->vm_start > PAGE_SIZE)
+        return -EINVAL;
+    if (vma->vm_flags & VM_WRITE)
+        return -EPERM;
+#ifdef HAVE_VM_FLAGS_CLEAR
+    vm_flags_clear(vma, VM_MAYWRITE);
+#else
+    vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+    return vm_insert_page(vma, vma->vm_start, virt_to_page(mk_state_page));
+}
+
+static const struct file_operations mk_cdev_fops = {
+    .owner = THIS_MODULE,
+    .open = mk_cdev_open,
+    .read = mk_cdev_read,
+    .poll = mk_cdev_poll,
+    .mmap = mk_cdev_mmap,
+    .llseek = noop_llseek,
+};
+
+static struct miscdevice mk_miscdev = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = "am_arcade",
+    .fops = &mk_cdev_fops,
+    .mode = 0444,
+};
+
+static int __init mk_cdev_init(struct mk *mk) {
+    struct mk_state_page *page = (struct mk_state_page *)get_zeroed_page(GFP_KERNEL);
+    int i, err;
+
+    if (!page)
+        return -ENOMEM;
+
+    page->pad_count = MK_MAX_DEVICES;
+    spin_lock_irq(&mk_state_lock);
+    for (i = 0; i < MK_MAX_DEVICES; i++)
+        page->state[i] = mk->pads[i].state;
+    mk_state_page = page;
+    spin_unlock_irq(&mk_state_lock);
+
+    err = misc_register(&mk_miscdev);
+    if (err) {
+        spin_lock_irq(&mk_state_lock);
+        mk_state_page = NULL;
+        spin_unlock_irq(&mk_state_lock);
+        free_page((unsigned long)page);
+    }
+    return err;
+}
+
+static void mk_cdev_exit(void) {
+    struct mk_state_page *page = mk_state_page;
+
+    if (!page)
+        return;
+    misc_deregister(&mk_miscdev);
+    spin_lock_irq(&mk_state_lock);
+    mk_state_page = NULL;
+    spin_unlock_irq(&mk_state_lock);
+    free_page((unsigned long)page);
+}
+
 static int __init mk_init(void) {
     /* Set up gpio pointer for direct register access */
     if ((gpio = ioremap(GPIO_BASE, 0xB0)) == NULL) {
@@ -665,6 +1227,16 @@ static int __init mk_init(void) {
         pr_err("io remap failed\n");
         return -EBUSY;
     }
+    if (mk_hc165_spi && (spi0 = ioremap(SPI0_BASE, 0x18)) == NULL) {
+        pr_err("io remap failed\n");
+        return -EBUSY;
+    }
+    bsc_init();
+    mk_debounce_n = clamp(mk_debounce_n, 1, 7);
+    if (mk_poll_cpu >= 0 && (mk_poll_cpu >= nr_cpu_ids || !cpu_online(mk_poll_cpu))) {
+        pr_err("CPU %d is not online, polling from a timer\n", mk_poll_cpu);
+        mk_poll_cpu = -1;
+    }
     if (mk_cfg.nargs < 1) {
         pr_err("at least one device must be specified\n");
         return -EINVAL;
@@ -673,15 +1245,22 @@ static int __init mk_init(void) {
         if (IS_ERR(mk_base))
             return -ENODEV;
     }
+    mk_debugfs_init();
+    if (mk_chardev && mk_cdev_init(mk_base))
+        pr_err("/dev/am_arcade not available\n");
     return 0;
 }
 
 static void __exit mk_exit(void) {
+    debugfs_remove_recursive(mk_debugfs_dir);
+    mk_cdev_exit();
     if (mk_base)
         mk_remove(mk_base);
 
     iounmap(gpio);
     iounmap(bsc1);
+    if (spi0)
+        iounmap(spi0);
 }
 
 module_init(mk_init);
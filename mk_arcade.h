@@ -0,0 +1,110 @@
+/*
+ * Pads and the state of the driver, shared by the backends
+ */
+
+#define MK_MAX_DEVICES		9
+
+enum mk_type {
+    MK_NONE = 0,
+    MK_ARCADE_GPIO,
+    MK_ARCADE_GPIO_BPLUS,
+    MK_ARCADE_MCP23017,
+    MK_ARCADE_GPIO_TFT,
+    MK_ARCADE_GPIO_CUSTOM,
+    MK_ARCADE_GPIO_MULTIPLEXER,
+    MK_ARCADE_GPIO_74HC165,
+    MK_MAX
+};
+
+// Packed pad state : bit 0 up, 1 down, 2 left, 3 right, then one bit per button
+#define MK_STATE_Y	0x3
+#define MK_STATE_X	0xc
+#define MK_STATE_BTN_SHIFT	4
+#define MK_STATE_MASK(n)	((n) < 32 ? (1U << (n)) - 1 : ~0U)
+
+// Polling settings, the module parameters a tick reads
+struct mk_poll_cfg {
+    int debounce_mode;
+    int debounce_n;
+    unsigned int mux_ns;
+    bool mux_paced;
+    unsigned int hc165_ns;
+    bool hc165_spi;
+    bool msc_timestamp;
+};
+
+struct mk_pad {
+    struct input_dev *dev;
+    int idx;
+    enum mk_type type;
+    char phys[32];
+    int mcp23017addr;
+    struct bsc_xfer xfer;
+    char i2c_buf[2];
+    int gpio_maps[16];
+    u32 button_mask;
+    unsigned char gpio_shift[16];
+    int irqs[16];
+    int irq_count;
+    ktime_t irq_time;
+    bool latch;
+    bool open;
+    atomic_t seen_on;
+    atomic_t seen_off;
+    int start_offs;
+    int button_count;
+    ktime_t period;
+    ktime_t next_due;
+    u32 debounce[3];
+    u32 state;
+};
+
+struct mk {
+    struct mk_pad pads[MK_MAX_DEVICES];
+    struct hrtimer timer;
+    struct task_struct *thread;
+    ktime_t period;
+    int pad_count[MK_MAX];
+    int hc165_bits;
+    // the multiplexer pads share the address lines, and one scan of their channels
+    unsigned char mux_addr[16];
+    u32 mux_set[16];
+    u32 mux_clr[16];
+    int mux_steps;
+    int mux_start;
+    int mux_end;
+    // a scan paced by mux_timer : the next step, the level at each channel and the pads to report
+    struct hrtimer mux_timer;
+    int mux_pos;
+    u32 mux_lev[16];
+    unsigned int mux_due;
+    ktime_t mux_begin;
+    bool mux_busy;
+    int poll_used;  // open polled pads, polling runs while there is one
+    struct mk_poll_cfg cfg;
+    unsigned long *class_overruns;  // missed deadlines per pad type
+    struct mutex mutex;
+    struct mutex irq_mutex;
+};
+
+// Key codes of the buttons, in the order of their state bits
+static const short mk_arcade_btn[] = {
+	BTN_START, BTN_SELECT, BTN_A, BTN_B, BTN_TR, BTN_Y, BTN_X, BTN_TL, BTN_C, BTN_TR2, BTN_Z, BTN_TL2, 
+
+    BTN_MISC + 0, BTN_MISC + 1, BTN_MISC + 2, BTN_MISC + 3, BTN_MISC + 4, BTN_MISC + 5, BTN_MISC + 6, BTN_MISC + 7, 
+    BTN_MISC + 8, BTN_MISC + 9, BTN_MISC + 10, BTN_MISC + 11, BTN_MISC + 12, BTN_MISC + 13, BTN_MISC + 14, BTN_MISC + 15
+};
+
+// Emit the events of the axes and buttons that changed in state, keys being the codes of the buttons
+static void mk_report_state(struct input_dev *dev, u32 state, u32 changed, const short *keys) {
+    int j;
+
+    if (changed & MK_STATE_Y)
+        input_report_abs(dev, ABS_Y, !(state & 0x1) - !(state & 0x2));
+    if (changed & MK_STATE_X)
+        input_report_abs(dev, ABS_X, !(state & 0x4) - !(state & 0x8));
+    for (changed >>= MK_STATE_BTN_SHIFT; changed; changed &= changed - 1) {
+        j = __ffs(changed);
+        input_report_key(dev, keys[j], (state >> (j + MK_STATE_BTN_SHIFT)) & 0x1);
+    }
+}
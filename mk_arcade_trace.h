@@ -0,0 +1,120 @@
+/*
+ *  Tracepoints of the Arcade Joystick Driver for RaspberryPi
+ *
+ *  Enable them with trace-cmd or perf, for example :
+ *      trace-cmd record -e mk_arcade
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM mk_arcade
+
+#if !defined(_MK_ARCADE_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _MK_ARCADE_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(mk_tick,
+
+    TP_PROTO(s64 deadline, s64 late),
+
+    TP_ARGS(deadline, late),
+
+    TP_STRUCT__entry(
+        __field(s64, deadline)
+        __field(s64, late)
+    ),
+
+    TP_fast_assign(
+        __entry->deadline = deadline;
+        __entry->late = late;
+    ),
+
+    TP_printk("deadline=%lld late=%lldns", __entry->deadline, __entry->late)
+);
+
+TRACE_EVENT(mk_read,
+
+    TP_PROTO(int pad, int type, u32 raw),
+
+    TP_ARGS(pad, type, raw),
+
+    TP_STRUCT__entry(
+        __field(int, pad)
+        __field(int, type)
+        __field(u32, raw)
+    ),
+
+    TP_fast_assign(
+        __entry->pad = pad;
+        __entry->type = type;
+        __entry->raw = raw;
+    ),
+
+    TP_printk("pad=%d type=%d raw=0x%08x", __entry->pad, __entry->type, __entry->raw)
+);
+
+TRACE_EVENT(mk_report,
+
+    TP_PROTO(int pad, u32 state, u32 changed),
+
+    TP_ARGS(pad, state, changed),
+
+    TP_STRUCT__entry(
+        __field(int, pad)
+        __field(u32, state)
+        __field(u32, changed)
+    ),
+
+    TP_fast_assign(
+        __entry->pad = pad;
+        __entry->state = state;
+        __entry->changed = changed;
+    ),
+
+    TP_printk("pad=%d state=0x%08x changed=0x%08x", __entry->pad, __entry->state, __entry->changed)
+);
+
+DECLARE_EVENT_CLASS(mk_i2c,
+
+    TP_PROTO(u8 dev_addr, u8 reg_addr, u16 len, bool write, int err),
+
+    TP_ARGS(dev_addr, reg_addr, len, write, err),
+
+    TP_STRUCT__entry(
+        __field(u8, dev_addr)
+        __field(u8, reg_addr)
+        __field(u16, len)
+        __field(bool, write)
+        __field(int, err)
+    ),
+
+    TP_fast_assign(
+        __entry->dev_addr = dev_addr;
+        __entry->reg_addr = reg_addr;
+        __entry->len = len;
+        __entry->write = write;
+        __entry->err = err;
+    ),
+
+    TP_printk("addr=0x%02x reg=0x%02x len=%u %s err=%d", __entry->dev_addr, __entry->reg_addr,
+        __entry->len, __entry->write ? "write" : "read", __entry->err)
+);
+
+DEFINE_EVENT(mk_i2c, mk_i2c_start,
+    TP_PROTO(u8 dev_addr, u8 reg_addr, u16 len, bool write, int err),
+    TP_ARGS(dev_addr, reg_addr, len, write, err)
+);
+
+DEFINE_EVENT(mk_i2c, mk_i2c_done,
+    TP_PROTO(u8 dev_addr, u8 reg_addr, u16 len, bool write, int err),
+    TP_ARGS(dev_addr, reg_addr, len, write, err)
+);
+
+#endif /* _MK_ARCADE_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE mk_arcade_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,301 @@
+/*
+ * Defines for I2C peripheral (aka BSC, or Broadcom Serial Controller)
+ */
+
+#define BSC_C_I2CEN	(1 << 15)
+#define BSC_C_INTR	(1 << 10)
+#define BSC_C_INTT	(1 << 9)
+#define BSC_C_INTD	(1 << 8)
+#define BSC_C_ST	(1 << 7)
+#define BSC_C_CLEAR	(1 << 4)
+#define BSC_C_READ	1
+
+#define START_READ	BSC_C_I2CEN|BSC_C_ST|BSC_C_CLEAR|BSC_C_READ
+#define START_WRITE	BSC_C_I2CEN|BSC_C_ST
+
+#define BSC_S_CLKT	(1 << 9)
+#define BSC_S_ERR	(1 << 8)
+#define BSC_S_RXF	(1 << 7)
+#define BSC_S_TXE	(1 << 6)
+#define BSC_S_RXD	(1 << 5)
+#define BSC_S_TXD	(1 << 4)
+#define BSC_S_RXR	(1 << 3)
+#define BSC_S_TXW	(1 << 2)
+#define BSC_S_DONE	(1 << 1)
+#define BSC_S_TA	1
+
+#define CLEAR_STATUS	BSC_S_CLKT|BSC_S_ERR|BSC_S_DONE
+
+
+/* I2C UTILS */
+static void i2c_init(void) {
+    INP_GPIO(2);
+    SET_GPIO_ALT(2, 0);
+    INP_GPIO(3);
+    SET_GPIO_ALT(3, 0);
+}
+
+/*
+ * Asynchronous BSC engine
+ *
+ * Transfers are queued and run one after the other by a state machine on an hrtimer.
+ * Each expiry reads the status register once, moves the transfer to its next phase,
+ * and sleeps for the time the bus needs to move the next bytes, so nothing spins on
+ * the status register. The completion callback runs in the timer's context.
+ *
+ * A finished transfer starts the next queued one from the same expiry, so a batch of
+ * reads submitted together streams back-to-back on the bus.
+ */
+
+#define BSC_BYTE_NS	90000	// 9 clocks at 100 kHz
+#define BSC_POLL_NS	20000
+
+enum bsc_state {
+    BSC_IDLE,
+    BSC_WRITE,
+    BSC_ADDR,
+    BSC_READ,
+};
+
+struct bsc_xfer {
+    struct list_head node;
+    char dev_addr;
+    char reg_addr;
+    char *buf;
+    unsigned short len;
+    bool write;
+    bool keep_addr;     // the device register pointer is back at reg_addr after a read
+    bool addr_ok;       // so the next read can skip the register address phase
+    bool queued;
+    int err;
+    ktime_t submitted;  // when it was queued, for the read latency statistics
+    void (*callback)(struct bsc_xfer *xfer);
+    struct completion done;
+};
+
+static DEFINE_SPINLOCK(bsc_lock);
+static LIST_HEAD(bsc_queue);
+static struct bsc_xfer *bsc_cur;
+static struct bsc_xfer *bsc_calling;   // the finished transfer whose callback runs
+static enum bsc_state bsc_state;
+static unsigned short bsc_pos;
+static struct hrtimer bsc_timer;
+
+// Start the register address phase of a read, or the whole write. Returns the time it takes.
+static u64 bsc_start(struct bsc_xfer *xfer) {
+    int idx, bytes;
+
+    trace_mk_i2c_start(xfer->dev_addr, xfer->reg_addr, xfer->len, xfer->write, 0);
+    mk_bsc_write(BSC_A, xfer->dev_addr);
+    mk_bsc_write(BSC_S, CLEAR_STATUS); // Reset status bits (see #define)
+    if (xfer->write) {
+        // This doesn't refill the FIFO, so writes are limited to 16 bytes including the register address
+        mk_bsc_write(BSC_DLEN, xfer->len + 1);
+        mk_bsc_write(BSC_FIFO, xfer->reg_addr);
+        for (idx = 0; idx < xfer->len; idx++)
+            mk_bsc_write(BSC_FIFO, xfer->buf[idx]);
+        bsc_state = BSC_WRITE;
+        bytes = xfer->len + 2;
+    } else if (xfer->addr_ok) {
+        mk_bsc_write(BSC_DLEN, xfer->len);
+        mk_bsc_write(BSC_C, START_READ); // Start Read after clearing FIFO (see #define)
+        bsc_state = BSC_READ;
+        return (u64)(xfer->len + 1) * BSC_BYTE_NS;
+    } else {
+        mk_bsc_write(BSC_DLEN, 1);
+        mk_bsc_write(BSC_FIFO, xfer->reg_addr);
+        bsc_state = BSC_ADDR;
+        bytes = 2;
+    }
+    mk_bsc_write(BSC_C, START_WRITE); // Start Write (see #define)
+    return (u64)bytes * BSC_BYTE_NS;
+}
+
+// Pop the next queued transfer and start it, with bsc_lock held. Returns 0 when the queue is empty.
+static u64 bsc_start_next(void) {
+    bsc_cur = list_first_entry_or_null(&bsc_queue, struct bsc_xfer, node);
+    if (!bsc_cur) {
+        bsc_state = BSC_IDLE;
+        return 0;
+    }
+    list_del(&bsc_cur->node);
+    bsc_pos = 0;
+    return bsc_start(bsc_cur);
+}
+
+static enum hrtimer_restart bsc_timer_fn(struct hrtimer *t) {
+    struct bsc_xfer *xfer, *done = NULL;
+    unsigned long flags;
+    unsigned status;
+    u64 next_ns = 0;
+
+    spin_lock_irqsave(&bsc_lock, flags);
+    xfer = bsc_cur;
+    if (!xfer) {
+        spin_unlock_irqrestore(&bsc_lock, flags);
+        return HRTIMER_NORESTART;
+    }
+
+    status = mk_bsc_read(BSC_S);
+    if (bsc_state == BSC_READ) {
+        // Consume the FIFO
+        while ((status & BSC_S_RXD) && bsc_pos < xfer->len) {
+            xfer->buf[bsc_pos++] = mk_bsc_read(BSC_FIFO);
+            status = mk_bsc_read(BSC_S);
+        }
+    }
+
+    if (status & (BSC_S_ERR | BSC_S_CLKT)) {
+        mk_bsc_write(BSC_S, CLEAR_STATUS);
+        xfer->err = -EIO;
+        xfer->addr_ok = false;
+        done = xfer;
+    } else if (!(status & BSC_S_DONE)) {
+        next_ns = BSC_POLL_NS;
+    } else if (bsc_state == BSC_ADDR) {
+        mk_bsc_write(BSC_DLEN, xfer->len);
+        mk_bsc_write(BSC_S, CLEAR_STATUS); // Reset status bits (see #define)
+        mk_bsc_write(BSC_C, START_READ); // Start Read after clearing FIFO (see #define)
+        bsc_state = BSC_READ;
+        next_ns = (u64)(xfer->len + 1) * BSC_BYTE_NS;
+    } else {
+        xfer->err = 0;
+        xfer->addr_ok = xfer->keep_addr && !xfer->write;
+        done = xfer;
+    }
+
+    if (done) {
+        trace_mk_i2c_done(done->dev_addr, done->reg_addr, done->len, done->write, done->err);
+        done->queued = false;
+        bsc_calling = done;
+        next_ns = bsc_start_next();
+    }
+    spin_unlock_irqrestore(&bsc_lock, flags);
+
+    if (done) {
+        if (done->callback)
+            done->callback(done);
+        spin_lock_irqsave(&bsc_lock, flags);
+        bsc_calling = NULL;
+        spin_unlock_irqrestore(&bsc_lock, flags);
+    }
+
+    if (!next_ns)
+        return HRTIMER_NORESTART;
+    hrtimer_set_expires(t, ktime_add_ns(ktime_get(), next_ns));
+    return HRTIMER_RESTART;
+}
+
+// Queue a batch of transfers. The ones still queued or running from a previous submit are skipped.
+// Returns the number of transfers queued.
+static int bsc_submit_batch(struct bsc_xfer **xfers, int count) {
+    unsigned long flags;
+    ktime_t now = ktime_get();
+    int i, queued = 0;
+    u64 ns = 0;
+
+    spin_lock_irqsave(&bsc_lock, flags);
+    for (i = 0; i < count; i++) {
+        if (xfers[i]->queued)
+            continue;
+        xfers[i]->queued = true;
+        xfers[i]->submitted = now;
+        list_add_tail(&xfers[i]->node, &bsc_queue);
+        queued++;
+    }
+    if (queued && !bsc_cur)
+        ns = bsc_start_next();
+    spin_unlock_irqrestore(&bsc_lock, flags);
+
+    if (ns)
+        hrtimer_start(&bsc_timer, ns_to_ktime(ns), MK_HRTIMER_MODE_REL);
+    return queued;
+}
+
+// Queue a transfer. Returns -EBUSY if it is still queued or running from a previous submit.
+static int bsc_submit(struct bsc_xfer *xfer) {
+    return bsc_submit_batch(&xfer, 1) ? 0 : -EBUSY;
+}
+
+// Drop a queued transfer, or wait until a running one and its callback are done. Sleeps.
+static void bsc_cancel(struct bsc_xfer *xfer) {
+    unsigned long flags;
+    bool busy;
+
+    for (;;) {
+        spin_lock_irqsave(&bsc_lock, flags);
+        busy = xfer == bsc_cur || xfer == bsc_calling;
+        if (!busy && xfer->queued) {
+            list_del(&xfer->node);
+            xfer->queued = false;
+        }
+        spin_unlock_irqrestore(&bsc_lock, flags);
+        if (!busy)
+            return;
+        usleep_range(BSC_POLL_NS / 1000, 2 * BSC_POLL_NS / 1000);
+    }
+}
+
+static void bsc_xfer_done(struct bsc_xfer *xfer) {
+    complete(&xfer->done);
+}
+
+// Run a transfer and sleep until it completes, for process context callers.
+static int bsc_xfer_sync(struct bsc_xfer *xfer) {
+    xfer->callback = bsc_xfer_done;
+    init_completion(&xfer->done);
+    bsc_submit(xfer);
+    wait_for_completion(&xfer->done);
+    return xfer->err;
+}
+
+static void bsc_init(void) {
+#ifdef HAVE_HRTIMER_SETUP
+    hrtimer_setup(&bsc_timer, bsc_timer_fn, CLOCK_MONOTONIC, MK_HRTIMER_MODE_REL);
+#else
+    hrtimer_init(&bsc_timer, CLOCK_MONOTONIC, MK_HRTIMER_MODE_REL);
+    bsc_timer.function = bsc_timer_fn;
+#endif
+}
+
+// Stop the engine and drop queued transfers, once nothing submits anymore.
+static void bsc_exit(void) {
+    unsigned long flags;
+
+    hrtimer_cancel(&bsc_timer);
+    spin_lock_irqsave(&bsc_lock, flags);
+    INIT_LIST_HEAD(&bsc_queue);
+    bsc_cur = NULL;
+    bsc_calling = NULL;
+    bsc_state = BSC_IDLE;
+    spin_unlock_irqrestore(&bsc_lock, flags);
+}
+
+// Function to write data to an I2C device via the FIFO. Sleeps until the write is done.
+// This doesn't refill the FIFO, so writes are limited to 16 bytes including the register address.
+
+static int i2c_write(char dev_addr, char reg_addr, char *buf, unsigned short len) {
+    struct bsc_xfer xfer = {
+        .dev_addr = dev_addr,
+        .reg_addr = reg_addr,
+        .buf = buf,
+        .len = len,
+        .write = true,
+    };
+
+    return bsc_xfer_sync(&xfer);
+}
+
+// Function to read a number of bytes into a buffer from an I2C device. Sleeps until the read is done.
+
+static int i2c_read(char dev_addr, char reg_addr, char *buf, unsigned short len) {
+    struct bsc_xfer xfer = {
+        .dev_addr = dev_addr,
+        .reg_addr = reg_addr,
+        .buf = buf,
+        .len = len,
+    };
+
+    memset(buf, 0, len); // clear the buffer
+    return bsc_xfer_sync(&xfer);
+}
@@ -0,0 +1,108 @@
+/*
+ * Register access
+ *
+ * Every GPIO, BSC and SPI register access goes through mk_gpio_read/write(),
+ * mk_bsc_read/write() and mk_spi_read/write(), so the backends don't depend on how the peripherals are reached.
+ * The module maps them with ioremap(). Building with MK_HAL_SIM routes the accessors to
+ * mk_sim_read()/mk_sim_write() instead : the host build in test/ runs the backends against
+ * the simulated registers and devices of test/mk_sim.c.
+ */
+
+// GPIO registers, byte offsets
+#define GPFSEL0		0x00
+#define GPSET0		0x1c
+#define GPCLR0		0x28
+#define GPLEV0		0x34
+#define GPPUD		0x94
+#define GPPUDCLK0	0x98
+
+// BSC registers, byte offsets
+#define BSC_C		0x00
+#define BSC_S		0x04
+#define BSC_DLEN	0x08
+#define BSC_A		0x0c
+#define BSC_FIFO	0x10
+
+// SPI registers, byte offsets
+#define SPI_CS		0x00
+#define SPI_FIFO	0x04
+#define SPI_CLK		0x08
+
+static void __iomem *gpio;
+static void __iomem *bsc1;
+static void __iomem *spi0;
+
+#ifdef MK_HAL_SIM
+
+enum mk_sim_bank {
+    MK_SIM_GPIO,
+    MK_SIM_BSC1,
+    MK_SIM_SPI0,
+};
+
+u32 mk_sim_read(enum mk_sim_bank bank, unsigned int reg);
+void mk_sim_write(enum mk_sim_bank bank, unsigned int reg, u32 val);
+
+static inline u32 mk_gpio_read(unsigned int reg) {
+    return mk_sim_read(MK_SIM_GPIO, reg);
+}
+
+static inline void mk_gpio_write(unsigned int reg, u32 val) {
+    mk_sim_write(MK_SIM_GPIO, reg, val);
+}
+
+static inline u32 mk_bsc_read(unsigned int reg) {
+    return mk_sim_read(MK_SIM_BSC1, reg);
+}
+
+static inline void mk_bsc_write(unsigned int reg, u32 val) {
+    mk_sim_write(MK_SIM_BSC1, reg, val);
+}
+
+static inline u32 mk_spi_read(unsigned int reg) {
+    return mk_sim_read(MK_SIM_SPI0, reg);
+}
+
+static inline void mk_spi_write(unsigned int reg, u32 val) {
+    mk_sim_write(MK_SIM_SPI0, reg, val);
+}
+
+#else
+
+// The peripherals are strongly ordered, relaxed accessors keep the hot path free of barriers
+static inline u32 mk_gpio_read(unsigned int reg) {
+    return readl_relaxed(gpio + reg);
+}
+
+static inline void mk_gpio_write(unsigned int reg, u32 val) {
+    writel_relaxed(val, gpio + reg);
+}
+
+static inline u32 mk_bsc_read(unsigned int reg) {
+    return readl_relaxed(bsc1 + reg);
+}
+
+static inline void mk_bsc_write(unsigned int reg, u32 val) {
+    writel_relaxed(val, bsc1 + reg);
+}
+
+static inline u32 mk_spi_read(unsigned int reg) {
+    return readl_relaxed(spi0 + reg);
+}
+
+static inline void mk_spi_write(unsigned int reg, u32 val) {
+    writel_relaxed(val, spi0 + reg);
+}
+
+#endif
+
+#define GPFSEL(g)	(GPFSEL0 + ((g) / 10) * 4)
+#define GPFSEL_SHIFT(g)	(((g) % 10) * 3)
+
+#define INP_GPIO(g) mk_gpio_write(GPFSEL(g), mk_gpio_read(GPFSEL(g)) & ~(7 << GPFSEL_SHIFT(g)))
+#define OUT_GPIO(g) mk_gpio_write(GPFSEL(g), mk_gpio_read(GPFSEL(g)) | (1 << GPFSEL_SHIFT(g)))
+#define SET_GPIO_ALT(g,a) mk_gpio_write(GPFSEL(g), mk_gpio_read(GPFSEL(g)) | (((a)<=3?(a)+4:(a)==4?3:2) << GPFSEL_SHIFT(g)))
+
+#define GPIO_LEV0 mk_gpio_read(GPLEV0)
+#define GPIO_READ(g)  (GPIO_LEV0 & (1<<(g)))
+#define GET_GPIO(g) (GPIO_LEV0 & (1<<(g)))
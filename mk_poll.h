@@ -0,0 +1,416 @@
+/*
+ * Polling of the pads : the tick that reads every due pad, the reports, their debounce and
+ * statistics. The module runs it from its timer or polling thread, the host build in test/
+ * against the simulated registers.
+ */
+
+// Histogram bucket n counts the durations from 2^n to 2^(n+1) - 1 ns, the last one everything above
+#define MK_HIST_BUCKETS	24
+
+/*
+ * Counters and histograms exported in debugfs. The tick, the I2C and multiplexer timers
+ * and the pad interrupt handlers write them from any CPU at once, so each CPU has its own
+ * copy, bumped with this_cpu ops, and debugfs shows their sum. A reader may still see a
+ * sample counted in one place and not yet in another.
+ */
+
+struct mk_stats {
+    unsigned long samples;
+    unsigned long events;
+    unsigned long i2c_xfers;
+    unsigned long errors;
+};
+
+struct mk_cpu_stats {
+    struct mk_stats pads[MK_MAX_DEVICES];
+    struct mk_stats types[MK_MAX];
+    unsigned long read_hist[MK_MAX][MK_HIST_BUCKETS];
+    unsigned long tick_hist[MK_HIST_BUCKETS];
+    unsigned long late_hist[MK_HIST_BUCKETS];
+};
+
+static DEFINE_PER_CPU(struct mk_cpu_stats, mk_cpu_stats);
+
+static int mk_hist_bucket(s64 ns) {
+    int n = ns > 1 ? fls64(ns) - 1 : 0;
+
+    return min(n, MK_HIST_BUCKETS - 1);
+}
+
+// Count a pad sample, read since start
+static void mk_stats_sample(struct mk_pad * pad, ktime_t start) {
+    this_cpu_inc(mk_cpu_stats.pads[pad->idx].samples);
+    this_cpu_inc(mk_cpu_stats.types[pad->type].samples);
+    this_cpu_inc(mk_cpu_stats.read_hist[pad->type][mk_hist_bucket(ktime_to_ns(ktime_sub(ktime_get(), start)))]);
+}
+
+static void mk_stats_error(struct mk_pad * pad) {
+    this_cpu_inc(mk_cpu_stats.pads[pad->idx].errors);
+    this_cpu_inc(mk_cpu_stats.types[pad->type].errors);
+}
+
+static void mk_stats_i2c(struct mk_pad * pad, int err) {
+    this_cpu_inc(mk_cpu_stats.pads[pad->idx].i2c_xfers);
+    this_cpu_inc(mk_cpu_stats.types[pad->type].i2c_xfers);
+    if (err)
+        mk_stats_error(pad);
+}
+
+static void mk_stats_events(struct mk_pad * pad, unsigned int events) {
+    this_cpu_add(mk_cpu_stats.pads[pad->idx].events, events);
+    this_cpu_add(mk_cpu_stats.types[pad->type].events, events);
+}
+
+enum mk_debounce_mode {
+    MK_DEBOUNCE_OFF = 0,
+    MK_DEBOUNCE_EAGER,
+    MK_DEBOUNCE_DEFERRED,
+};
+
+/*
+ * All the buttons of a pad are debounced at once with vertical counters : bit n of
+ * debounce[0..2] holds the 3-bit sample counter of button n. pad->state is the
+ * debounced state, as it is the last reported one. n is the number of polls, 1 to 7.
+ */
+
+static u32 mk_debounce_eager(struct mk_pad * pad, u32 raw, int n) {
+    u32 *c = pad->debounce;
+    u32 lock = c[0] | c[1] | c[2];
+    u32 accept = (raw ^ pad->state) & ~lock;
+    u32 borrow = lock;
+    int k;
+
+    // count down the lockout of the buttons that changed lately
+    for (k = 0; k < 3; k++) {
+        u32 next = borrow & ~c[k];
+        c[k] ^= borrow;
+        borrow = next;
+    }
+    // report a new edge at once, then lock the button out for n polls
+    for (k = 0; k < 3; k++)
+        c[k] = (c[k] & ~accept) | (((n >> k) & 0x1) ? accept : 0);
+
+    return pad->state ^ accept;
+}
+
+static u32 mk_debounce_deferred(struct mk_pad * pad, u32 raw, int n) {
+    u32 *c = pad->debounce;
+    u32 delta = raw ^ pad->state;
+    u32 carry = delta, stable = delta;
+    int k;
+
+    // count the successive polls each button differs from its reported state
+    for (k = 0; k < 3; k++) {
+        u32 next = carry & c[k];
+        c[k] = (c[k] ^ carry) & delta;
+        carry = next;
+        stable &= ((n >> k) & 0x1) ? c[k] : ~c[k];
+    }
+    // report the changes that lasted n polls
+    for (k = 0; k < 3; k++)
+        c[k] &= ~stable;
+
+    return pad->state ^ stable;
+}
+
+static u32 mk_debounce(struct mk_pad * pad, u32 raw, int mode, int n) {
+    switch (mode) {
+        case MK_DEBOUNCE_EAGER:
+            return mk_debounce_eager(pad, raw, n);
+        case MK_DEBOUNCE_DEFERRED:
+            return mk_debounce_deferred(pad, raw, n);
+        default:
+            return raw;
+    }
+}
+
+// Sample a latching pad on an edge of its pins, and only record which buttons were seen pressed
+// and released. The next poll reports a button that went back to its reported state in between
+// as a press then a release, or the other way.
+static void mk_gpio_latch_edge(struct mk_pad * pad) {
+    u32 raw = mk_gpio_read_packet(pad, GPIO_LEV0);
+
+    atomic_or(raw, &pad->seen_on);
+    atomic_or(~raw & pad->button_mask, &pad->seen_off);
+}
+
+// The buttons of a latching pad seen pressed (on) or released (off) since its last poll, that
+// are back to their reported state in state : each one is to be reported as a press then a
+// release, or the other way, before state.
+static u32 mk_gpio_latch_pulse(struct mk_pad * pad, u32 state, u32 on, u32 off, int debounce_mode) {
+    u32 pulse;
+
+    // the deferred debounce drops anything shorter than a poll
+    if (debounce_mode == MK_DEBOUNCE_DEFERRED)
+        return 0;
+    // the buttons back to their reported state, seen in the other one since the last poll
+    pulse = ~(state ^ pad->state) & ((pad->state & off) | (~pad->state & on));
+    // the eager debounce drops what it locks out
+    if (debounce_mode == MK_DEBOUNCE_EAGER)
+        pulse &= ~(pad->debounce[0] | pad->debounce[1] | pad->debounce[2]);
+    return pulse;
+}
+
+// Check if a polled pad is due at this tick, and schedule its next poll on its own period grid.
+// The polls it missed are added to overruns.
+static bool mk_pad_due(struct mk_pad * pad, ktime_t now, unsigned long *overruns) {
+    s64 missed;
+
+    if (pad->next_due && ktime_before(now, pad->next_due))
+        return false;
+
+    if (!pad->next_due)
+        pad->next_due = now;
+    pad->next_due = ktime_add(pad->next_due, pad->period);
+    if (!ktime_after(pad->next_due, now)) {
+        missed = ktime_divns(ktime_sub(now, pad->next_due), ktime_to_ns(pad->period)) + 1;
+        *overruns += missed;
+        pad->next_due = ktime_add_ns(pad->next_due, missed * ktime_to_ns(pad->period));
+    }
+    return true;
+}
+
+static void mk_input_report(struct mk_pad * pad, u32 state, ktime_t sampled);
+// defined with /dev/am_arcade, along with the module
+static void mk_cdev_update(struct mk_pad * pad, u32 state, ktime_t sampled);
+
+static void mk_mcp23017_complete(struct bsc_xfer *xfer) {
+    struct mk_pad *pad = container_of(xfer, struct mk_pad, xfer);
+    struct mk *mk;
+    u32 raw;
+
+    // a read that was running when its pad was closed
+    if (!READ_ONCE(pad->open))
+        return;
+    mk_stats_i2c(pad, xfer->err);
+    if (xfer->err)
+        return;
+    mk = input_get_drvdata(pad->dev);
+    raw = mk_mcp23017_decode(pad, pad->i2c_buf[0], pad->i2c_buf[1]);
+    trace_mk_read(pad->idx, pad->type, raw);
+    // the read latency of a MCP23017 includes the time queued behind the other transfers
+    mk_stats_sample(pad, xfer->submitted);
+    // the port is sampled during the transfer, which just completed
+    mk_input_report(pad, mk_debounce(pad, raw, mk->cfg.debounce_mode, mk->cfg.debounce_n), ktime_get());
+}
+
+// sampled is when the pins were read, so events carry the time of the sample rather than of the report
+static void mk_input_report(struct mk_pad * pad, u32 state, ktime_t sampled) {
+    struct input_dev * dev = pad->dev;
+    struct mk *mk = input_get_drvdata(dev);
+    u32 changed;
+
+    // only report what changed since the last sample
+    changed = state ^ pad->state;
+    if (!changed)
+        return;
+    pad->state = state;
+    mk_cdev_update(pad, state, sampled);
+    trace_mk_report(pad->idx, state, changed);
+    mk_stats_events(pad, !!(changed & MK_STATE_Y) + !!(changed & MK_STATE_X) + hweight32(changed >> MK_STATE_BTN_SHIFT));
+
+    mk_report_state(dev, state, changed, mk_arcade_btn);
+    if (mk->cfg.msc_timestamp)
+        input_event(dev, EV_MSC, MSC_TIMESTAMP, (u32)ktime_to_us(sampled));
+#ifdef HAVE_INPUT_SET_TIMESTAMP
+    input_set_timestamp(dev, sampled);
+#endif
+    input_sync(dev);
+}
+
+// Read and report a pad in interrupt mode, on an edge of its pins
+static void mk_gpio_irq_report(struct mk_pad * pad) {
+    struct mk *mk = input_get_drvdata(pad->dev);
+    ktime_t start = ktime_get();
+    u32 state;
+
+    mutex_lock(&mk->irq_mutex);
+    state = mk_gpio_read_packet(pad, GPIO_LEV0);
+    mk_stats_sample(pad, start);
+    mk_input_report(pad, state, ktime_get());
+    mutex_unlock(&mk->irq_mutex);
+}
+
+/*
+ * mk_mux_timer() runs a multiplexer scan one step per expiry, so the CPU does not wait
+ * for the settle time of each channel. The due pads are reported at the end of the scan.
+ */
+
+static enum hrtimer_restart mk_mux_timer(struct hrtimer *t) {
+    struct mk *mk = container_of(t, struct mk, mux_timer);
+    struct mk_pad *pad;
+    ktime_t sampled;
+    int i;
+
+    mk->mux_lev[mk->mux_addr[mk->mux_pos]] = GPIO_LEV0;
+    if (++mk->mux_pos < mk->mux_steps) {
+        mk_multiplexer_step(mk, mk->mux_pos);
+        hrtimer_forward_now(t, ns_to_ktime(mk->cfg.mux_ns));
+        return HRTIMER_RESTART;
+    }
+    sampled = ktime_get();
+
+    for (i = 0; i < MK_MAX_DEVICES; i++) {
+        pad = &mk->pads[i];
+        // a pad closed during the scan may have no device anymore
+        if (!(mk->mux_due & (1 << i)) || !smp_load_acquire(&pad->open))
+            continue;
+        mk_stats_sample(pad, mk->mux_begin);
+        mk_input_report(pad, mk_debounce(pad, mk_multiplexer_read_packet(pad, mk->mux_lev), mk->cfg.debounce_mode, mk->cfg.debounce_n), sampled);
+    }
+    smp_store_release(&mk->mux_busy, false);
+    return HRTIMER_NORESTART;
+}
+
+// Start a timer paced scan for the due multiplexer pads. A scan still running from the last tick
+// is not restarted, the due pads are counted as overruns.
+static void mk_multiplexer_start(struct mk *mk, unsigned int due) {
+    if (smp_load_acquire(&mk->mux_busy)) {
+        mk->class_overruns[MK_ARCADE_GPIO_MULTIPLEXER] += hweight32(due);
+        pr_warn_once("Multiplexer scan still running at the next poll, skipped. Lower mux_ns or poll_hz\n");
+        return;
+    }
+    mk->mux_busy = true;
+    mk->mux_due = due;
+    mk->mux_pos = 0;
+    mk->mux_begin = ktime_get();
+    mk_multiplexer_step(mk, 0);
+    hrtimer_start(&mk->mux_timer, ns_to_ktime(mk->cfg.mux_ns), MK_HRTIMER_MODE_REL);
+}
+
+// Pads in interrupt mode are reported from their interrupt handler, latching pads are still polled
+static bool mk_pad_polled(struct mk_pad * pad) {
+    return !pad->irq_count || pad->latch;
+}
+
+// Report the short presses or releases a latching pad caught since its last poll, before its current state.
+// on and off are the edges its interrupt handler saw up to the read of state, and no later : an edge
+// seen after it would be taken for a tap already over, and reported as a press and a release.
+static void mk_gpio_report_latched(struct mk *mk, struct mk_pad * pad, u32 state, u32 on, u32 off, ktime_t sampled) {
+    u32 pulse = mk_gpio_latch_pulse(pad, state, on, off, mk->cfg.debounce_mode);
+
+    if (pulse)
+        mk_input_report(pad, pad->state ^ pulse, sampled);
+}
+
+static void mk_process_packet(struct mk *mk, ktime_t now) {
+
+    struct bsc_xfer *i2c_batch[MK_MAX_DEVICES];
+    struct mk_pad *pad, *hc165 = NULL;
+    ktime_t start = ktime_get(), read_start, sampled, hc165_start = 0, mux_start = 0, gpio_time = 0, mux_time = 0;
+    u32 gplev0 = 0, state, mux_lev[16], latch_on[MK_MAX_DEVICES], latch_off[MK_MAX_DEVICES];
+    u64 hc165_chain = 0;
+    unsigned int due = 0, mux_due = 0;
+    bool mux_inline = false;
+    int i, i2c_count = 0, gpio_count = 0, err = 0;
+
+    trace_mk_tick(ktime_to_ns(now), ktime_to_ns(ktime_sub(start, now)));
+    this_cpu_inc(mk_cpu_stats.late_hist[mk_hist_bucket(ktime_to_ns(ktime_sub(start, now)))]);
+
+    for (i = 0; i < MK_MAX_DEVICES; i++) {
+        pad = &mk->pads[i];
+        // interrupt mode pads are reported from their interrupt handler, and nobody reads the closed ones
+        if (pad->type == MK_NONE || !mk_pad_polled(pad) || !smp_load_acquire(&pad->open) || !mk_pad_due(pad, now, &mk->class_overruns[pad->type]))
+            continue;
+        due |= 1 << i;
+        if (pad->type == MK_ARCADE_MCP23017)
+            i2c_batch[i2c_count++] = &pad->xfer;
+        else if (pad->type == MK_ARCADE_GPIO || pad->type == MK_ARCADE_GPIO_BPLUS || pad->type == MK_ARCADE_GPIO_TFT || pad->type == MK_ARCADE_GPIO_CUSTOM)
+            gpio_count++;
+        else if (pad->type == MK_ARCADE_GPIO_MULTIPLEXER)
+            mux_due |= 1 << i;
+        else if (pad->type == MK_ARCADE_GPIO_74HC165)
+            hc165 = pad;
+    }
+
+    // queue the GPIOA/GPIOB reads of every due MCP23017 first, so the bus streams
+    // them while the other pads are read. Reads still running from the last poll are skipped.
+    if (i2c_count)
+        mk->class_overruns[MK_ARCADE_MCP23017] += i2c_count - bsc_submit_batch(i2c_batch, i2c_count);
+
+    // then start shifting the 74HC165 chain through SPI0, if it is used
+    if (hc165 && mk->cfg.hc165_spi) {
+        hc165_start = ktime_get();
+        mk_74hc165_spi_start(hc165, mk->hc165_bits, mk->cfg.hc165_ns);
+    }
+
+    // all due direct GPIO pads are sampled from the same level register snapshot, the edges
+    // latching pads saw are collected right before it so none of them is newer than the snapshot
+    if (gpio_count) {
+        for (i = 0; i < MK_MAX_DEVICES; i++) {
+            pad = &mk->pads[i];
+            if (!(due & (1 << i)) || !pad->latch)
+                continue;
+            latch_on[i] = atomic_xchg(&pad->seen_on, 0);
+            latch_off[i] = atomic_xchg(&pad->seen_off, 0);
+        }
+        gplev0 = GPIO_LEV0;
+        gpio_time = ktime_get();
+    }
+
+    // and all due multiplexer pads from the same scan, paced by a timer with mux_paced
+    if (mux_due && !mk->cfg.mux_paced) {
+        mux_inline = true;
+        mux_start = ktime_get();
+        mk_multiplexer_scan(mk, mux_lev, mk->cfg.mux_ns);
+        mux_time = ktime_get();
+    } else if (mux_due) {
+        mk_multiplexer_start(mk, mux_due);
+    }
+
+    for (i = 0; i < MK_MAX_DEVICES; i++) {
+        pad = &mk->pads[i];
+        if (!(due & (1 << i)))
+            continue;
+
+        read_start = ktime_get();
+        if (pad->type == MK_ARCADE_GPIO || pad->type == MK_ARCADE_GPIO_BPLUS || pad->type == MK_ARCADE_GPIO_TFT || pad->type == MK_ARCADE_GPIO_CUSTOM) {
+            state = mk_gpio_read_packet(pad, gplev0);
+            sampled = gpio_time;
+            if (pad->latch)
+                mk_gpio_report_latched(mk, pad, state, latch_on[i], latch_off[i], sampled);
+        } else if (pad->type == MK_ARCADE_MCP23017) {
+            // queued above, reported from mk_mcp23017_complete() once the bytes are in
+            continue;
+        } else if (pad->type == MK_ARCADE_GPIO_MULTIPLEXER) {
+            // reported from mk_mux_timer() at the end of a timer paced scan
+            if (!mux_inline)
+                continue;
+            // the read time of a multiplexer pad includes the scan
+            read_start = mux_start;
+            state = mk_multiplexer_read_packet(pad, mux_lev);
+            sampled = mux_time;
+        } else {
+            // 74HC165 pads are reported below
+            continue;
+        }
+
+        mk_stats_sample(pad, read_start);
+        mk_input_report(pad, mk_debounce(pad, state, mk->cfg.debounce_mode, mk->cfg.debounce_n), sampled);
+    }
+
+    // all due 74HC165 pads come from the same shift of their chain, which is collected last
+    // so a SPI0 shift runs during the other reads
+    if (hc165) {
+        if (mk->cfg.hc165_spi) {
+            err = mk_74hc165_spi_finish(mk->hc165_bits, &hc165_chain);
+        } else {
+            hc165_start = ktime_get();
+            hc165_chain = mk_74hc165_read_chain(hc165, mk->hc165_bits, mk->cfg.hc165_ns);
+        }
+        for (i = 0; i < MK_MAX_DEVICES; i++) {
+            pad = &mk->pads[i];
+            if (!(due & (1 << i)) || pad->type != MK_ARCADE_GPIO_74HC165)
+                continue;
+            if (err) {
+                mk_stats_error(pad);
+                continue;
+            }
+            // the read time of a 74HC165 pad includes the shift of the chain, its inputs are latched as it starts
+            mk_stats_sample(pad, hc165_start);
+            mk_input_report(pad, mk_debounce(pad, mk_74hc165_read_packet(pad, hc165_chain), mk->cfg.debounce_mode, mk->cfg.debounce_n), hc165_start);
+        }
+    }
+
+    this_cpu_inc(mk_cpu_stats.tick_hist[mk_hist_bucket(ktime_to_ns(ktime_sub(ktime_get(), start)))]);
+}
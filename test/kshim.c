@@ -0,0 +1,112 @@
+/*
+ * Virtual clock and hrtimers of the host build
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "kshim.h"
+#include "mk_sim.h"
+
+#define MK_SIM_TIMERS	64
+
+ktime_t mk_sim_now;
+unsigned long mk_sim_input_events;
+
+static struct hrtimer *timers[MK_SIM_TIMERS];
+static int timer_count;
+static unsigned long timer_expiries;
+
+static void timer_add(struct hrtimer *timer) {
+    if (timer->listed)
+        return;
+    if (timer_count == MK_SIM_TIMERS) {
+        fprintf(stderr, "kshim: too many hrtimers\n");
+        abort();
+    }
+    timer->listed = true;
+    timers[timer_count++] = timer;
+}
+
+void mk_sim_timers_reset(void) {
+    int i;
+
+    for (i = 0; i < timer_count; i++) {
+        timers[i]->active = false;
+        timers[i]->listed = false;
+    }
+    timer_count = 0;
+    timer_expiries = 0;
+}
+
+unsigned long mk_sim_timer_expiries(void) {
+    return timer_expiries;
+}
+
+void hrtimer_setup(struct hrtimer *timer, enum hrtimer_restart (*function)(struct hrtimer *),
+        int clock, enum hrtimer_mode mode) {
+    timer->function = function;
+    timer->active = false;
+    timer_add(timer);
+}
+
+void hrtimer_start(struct hrtimer *timer, ktime_t tim, enum hrtimer_mode mode) {
+    timer->expires = mode == HRTIMER_MODE_REL ? mk_sim_now + tim : tim;
+    timer->active = true;
+    timer_add(timer);
+}
+
+int hrtimer_cancel(struct hrtimer *timer) {
+    int active = timer->active;
+
+    timer->active = false;
+    return active;
+}
+
+u64 hrtimer_forward_now(struct hrtimer *timer, ktime_t interval) {
+    u64 overruns = 0;
+
+    while (timer->expires <= mk_sim_now) {
+        timer->expires += interval;
+        overruns++;
+    }
+    return overruns;
+}
+
+// Fire the first timer due by limit. Returns false when there is none.
+static bool run_next(ktime_t limit) {
+    struct hrtimer *next = NULL;
+    int i;
+
+    for (i = 0; i < timer_count; i++) {
+        if (timers[i]->active && timers[i]->expires <= limit && (!next || timers[i]->expires < next->expires))
+            next = timers[i];
+    }
+    if (!next)
+        return false;
+    if (next->expires > mk_sim_now)
+        mk_sim_now = next->expires;
+    next->active = false;
+    timer_expiries++;
+    // a timer started again from its callback stays queued
+    if (next->function(next) == HRTIMER_RESTART)
+        next->active = true;
+    return true;
+}
+
+void mk_sim_run_until(ktime_t t) {
+    while (run_next(t))
+        ;
+    if (mk_sim_now < t)
+        mk_sim_now = t;
+}
+
+void wait_for_completion(struct completion *x) {
+    while (!x->done) {
+        if (!run_next(KTIME_MAX)) {
+            fprintf(stderr, "kshim: waiting for a completion nothing will complete\n");
+            abort();
+        }
+    }
+    x->done--;
+}
@@ -0,0 +1,295 @@
+/*
+ * Host stand-ins for the kernel API used by the backend headers
+ *
+ * Time is virtual : ktime_get() returns the simulated clock, delays move it forward,
+ * and the hrtimers fire from mk_sim_run_until() or while waiting for a completion.
+ */
+
+#ifndef _MK_KSHIM_H
+#define _MK_KSHIM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int64_t s64;
+typedef s64 ktime_t;
+
+#define __iomem
+
+#define KTIME_MAX	INT64_MAX
+#define NSEC_PER_USEC	1000L
+
+#define container_of(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+#define DIV_ROUND_UP(n, d)	(((n) + (d) - 1) / (d))
+#define roundup(x, y)	((((x) + ((y) - 1)) / (y)) * (y))
+#define min(a, b)	({ __typeof__(a) _a = (a); __typeof__(b) _b = (b); _a < _b ? _a : _b; })
+#define max(a, b)	({ __typeof__(a) _a = (a); __typeof__(b) _b = (b); _a > _b ? _a : _b; })
+#define clamp(v, lo, hi)	min(max(v, lo), hi)
+
+#define READ_ONCE(x)	(*(volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, v)	(*(volatile __typeof__(x) *)&(x) = (v))
+
+static inline unsigned long __ffs(unsigned long x) {
+    return __builtin_ctzl(x);
+}
+
+static inline int fls64(u64 x) {
+    return x ? 64 - __builtin_clzll(x) : 0;
+}
+
+static inline unsigned int hweight32(u32 x) {
+    return __builtin_popcount(x);
+}
+
+static inline u8 bitrev8(u8 x) {
+    x = (x >> 4) | (x << 4);
+    x = ((x & 0xcc) >> 2) | ((x & 0x33) << 2);
+    return ((x & 0xaa) >> 1) | ((x & 0x55) << 1);
+}
+
+/* atomics and locks : the simulation runs on one thread */
+
+typedef struct {
+    int counter;
+} atomic_t;
+
+#define ATOMIC_INIT(i)	{ (i) }
+#define atomic_read(v)	((v)->counter)
+#define atomic_set(v, i)	((v)->counter = (i))
+#define atomic_or(i, v)	((v)->counter |= (i))
+
+static inline int atomic_xchg(atomic_t *v, int new) {
+    int old = v->counter;
+
+    v->counter = new;
+    return old;
+}
+
+#define smp_load_acquire(p)	READ_ONCE(*(p))
+#define smp_store_release(p, v)	WRITE_ONCE(*(p), v)
+
+struct mutex {
+    int locked;
+};
+
+#define mutex_init(lock)	((lock)->locked = 0)
+#define mutex_lock(lock)	((lock)->locked++)
+#define mutex_unlock(lock)	((lock)->locked--)
+
+typedef int spinlock_t;
+#define DEFINE_SPINLOCK(x)	spinlock_t x
+#define spin_lock_irqsave(lock, flags)	do { (void)(lock); (flags) = 0; } while (0)
+#define spin_unlock_irqrestore(lock, flags)	do { (void)(lock); (void)(flags); } while (0)
+
+struct task_struct;
+
+/* per CPU data : there is one CPU */
+
+#define DEFINE_PER_CPU(type, name)	type name
+#define this_cpu_inc(x)	((x)++)
+#define this_cpu_add(x, n)	((x) += (n))
+
+/* logging */
+
+#define pr_warn(fmt, ...)	fprintf(stderr, "kshim: " fmt, ##__VA_ARGS__)
+#define pr_warn_once(fmt, ...)	do { \
+    static bool _warned; \
+    if (!_warned) { \
+        _warned = true; \
+        pr_warn(fmt, ##__VA_ARGS__); \
+    } \
+} while (0)
+
+/* lists */
+
+struct list_head {
+    struct list_head *next, *prev;
+};
+
+#define LIST_HEAD_INIT(name)	{ &(name), &(name) }
+#define LIST_HEAD(name)	struct list_head name = LIST_HEAD_INIT(name)
+
+static inline void INIT_LIST_HEAD(struct list_head *list) {
+    list->next = list;
+    list->prev = list;
+}
+
+static inline void list_add_tail(struct list_head *entry, struct list_head *head) {
+    entry->prev = head->prev;
+    entry->next = head;
+    head->prev->next = entry;
+    head->prev = entry;
+}
+
+static inline void list_del(struct list_head *entry) {
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+    entry->next = entry->prev = NULL;
+}
+
+#define list_first_entry_or_null(head, type, member) \
+    ((head)->next != (head) ? container_of((head)->next, type, member) : NULL)
+
+/* virtual time */
+
+extern ktime_t mk_sim_now;
+
+static inline ktime_t ktime_get(void) {
+    return mk_sim_now;
+}
+
+#define ns_to_ktime(ns)	((ktime_t)(ns))
+#define ktime_to_ns(kt)	((s64)(kt))
+#define ktime_add(a, b)	((a) + (b))
+#define ktime_sub(a, b)	((a) - (b))
+#define ktime_add_ns(kt, ns)	((kt) + (ns))
+#define ktime_add_us(kt, us)	((kt) + (s64)(us) * NSEC_PER_USEC)
+#define ktime_after(a, b)	((a) > (b))
+#define ktime_before(a, b)	((a) < (b))
+#define ktime_to_us(kt)	((s64)(kt) / NSEC_PER_USEC)
+#define ktime_divns(kt, div)	((s64)(kt) / (s64)(div))
+
+// Busy waits move the clock without running the timers, like a CPU spinning in a timer callback
+static inline void ndelay(unsigned long ns) {
+    mk_sim_now += ns;
+}
+
+static inline void udelay(unsigned long us) {
+    mk_sim_now += us * NSEC_PER_USEC;
+}
+
+// Each turn of a polling loop : about an uncached peripheral read and a pause
+#define MK_SIM_RELAX_NS	100
+
+static inline void cpu_relax(void) {
+    mk_sim_now += MK_SIM_RELAX_NS;
+}
+
+// Sleeping lets the timers run
+void mk_sim_run_until(ktime_t t);
+
+static inline void usleep_range(unsigned long min_us, unsigned long max_us) {
+    mk_sim_run_until(mk_sim_now + min_us * NSEC_PER_USEC);
+}
+
+/* hrtimers */
+
+enum hrtimer_restart {
+    HRTIMER_NORESTART,
+    HRTIMER_RESTART,
+};
+
+enum hrtimer_mode {
+    HRTIMER_MODE_ABS,
+    HRTIMER_MODE_REL,
+};
+
+#define CLOCK_MONOTONIC	1
+#define HAVE_HRTIMER_SETUP
+#define MK_HRTIMER_MODE	HRTIMER_MODE_ABS
+#define MK_HRTIMER_MODE_REL	HRTIMER_MODE_REL
+
+struct hrtimer {
+    enum hrtimer_restart (*function)(struct hrtimer *);
+    ktime_t expires;
+    bool active;
+    bool listed;
+};
+
+void hrtimer_setup(struct hrtimer *timer, enum hrtimer_restart (*function)(struct hrtimer *),
+        int clock, enum hrtimer_mode mode);
+void hrtimer_start(struct hrtimer *timer, ktime_t tim, enum hrtimer_mode mode);
+int hrtimer_cancel(struct hrtimer *timer);
+u64 hrtimer_forward_now(struct hrtimer *timer, ktime_t interval);
+
+static inline void hrtimer_set_expires(struct hrtimer *timer, ktime_t tim) {
+    timer->expires = tim;
+}
+
+static inline ktime_t hrtimer_get_expires(const struct hrtimer *timer) {
+    return timer->expires;
+}
+
+/* completions, waiting for one runs the timers until it is done */
+
+struct completion {
+    unsigned int done;
+};
+
+static inline void init_completion(struct completion *x) {
+    x->done = 0;
+}
+
+static inline void complete(struct completion *x) {
+    x->done++;
+}
+
+void wait_for_completion(struct completion *x);
+
+/* input, the events are only counted */
+
+#define EV_MSC	0x04
+#define MSC_TIMESTAMP	0x05
+#define ABS_X	0x00
+#define ABS_Y	0x01
+
+#define BTN_MISC	0x100
+#define BTN_A	0x130
+#define BTN_B	0x131
+#define BTN_C	0x132
+#define BTN_X	0x133
+#define BTN_Y	0x134
+#define BTN_Z	0x135
+#define BTN_TL	0x136
+#define BTN_TR	0x137
+#define BTN_TL2	0x138
+#define BTN_TR2	0x139
+#define BTN_SELECT	0x13a
+#define BTN_START	0x13b
+
+struct input_dev {
+    void *drvdata;
+};
+
+static inline void *input_get_drvdata(struct input_dev *dev) {
+    return dev->drvdata;
+}
+
+static inline void input_set_drvdata(struct input_dev *dev, void *data) {
+    dev->drvdata = data;
+}
+
+extern unsigned long mk_sim_input_events;
+
+static inline void input_event(struct input_dev *dev, unsigned int type, unsigned int code, int value) {
+    mk_sim_input_events++;
+}
+
+static inline void input_sync(struct input_dev *dev) {
+}
+
+static inline void input_report_abs(struct input_dev *dev, unsigned int code, int value) {
+    mk_sim_input_events++;
+}
+
+static inline void input_report_key(struct input_dev *dev, unsigned int code, int value) {
+    mk_sim_input_events++;
+}
+
+/* tracepoints */
+
+#define trace_mk_tick(now, late)	do { } while (0)
+#define trace_mk_read(pad, type, raw)	do { } while (0)
+#define trace_mk_report(pad, state, changed)	do { } while (0)
+#define trace_mk_i2c_start(dev, reg, len, write, err)	do { } while (0)
+#define trace_mk_i2c_done(dev, reg, len, write, err)	do { } while (0)
+
+#endif
@@ -0,0 +1,258 @@
+/*
+ * Cost of the backend read paths and of a polling tick, against the simulated registers
+ *
+ * One line per operation, in whitespace-separated columns :
+ *	op		the operation
+ *	n		the number of pads it reads, or of changes it reports
+ *	loops		how many times it ran
+ *	ns_per_op	host CPU time, only comparable between runs on the same machine
+ *	accesses	register accesses, each one a bus cycle to the peripherals on a Pi
+ *	sim_ns		simulated time the operation waits for the devices : settle times,
+ *			LD pulses and bus transfers
+ *	timers		hrtimer expiries, each one an interrupt on a Pi
+ * The tick and report lines run mk_process_packet() and mk_input_report() of mk_poll.h, the
+ * code of the module, over n pads of one type; a tick runs until its timers are done, the last
+ * step of a paced multiplexer scan or the last batched MCP23017 read. The i2c lines read n
+ * MCP23017 one after the other as the module used to, or queued in one batch by a tick as it
+ * does now; their sim_ns runs until the last read completes, which the batch doesn't spend
+ * waiting.
+ */
+
+#include <time.h>
+
+#include "mk_test.h"
+
+#define BENCH_LOOPS	10000
+
+// the defaults of the module parameters, the others are those of mk_test_mk()
+#define BENCH_PERIOD	1000000
+#define BENCH_MUX_NS	5000
+#define BENCH_HC165_NS	50
+#define BENCH_HC165_SPI_HZ	8000000
+
+#define BENCH_HC165_BUTTONS	7	// so a chain of 9 pads fits in 64 bits
+#define BENCH_MCP23017_MAX	8	// addresses 0x20 to 0x27
+
+static const int bench_mux_addr[4] = { 5, 6, 13, 19 };
+static const int bench_mux_sig[MK_MAX_DEVICES] = { 26, 21, 20, 16, 12, 7, 8, 25, 24 };
+
+static struct mk mk;
+static unsigned long bench_overruns[MK_MAX];
+static ktime_t bench_now;
+
+struct bench {
+    const char *op;
+    int n;
+    int loops;
+    struct timespec host;
+    unsigned long accesses;
+    ktime_t sim;
+    unsigned long timers;
+};
+
+static void bench_begin(struct bench *b, const char *op, int n, int loops) {
+    b->op = op;
+    b->n = n;
+    b->loops = loops;
+    b->accesses = mk_sim_accesses();
+    b->sim = ktime_get();
+    b->timers = mk_sim_timer_expiries();
+    clock_gettime(CLOCK_MONOTONIC, &b->host);
+}
+
+static void bench_end(struct bench *b) {
+    struct timespec now;
+    double host_ns;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    host_ns = (now.tv_sec - b->host.tv_sec) * 1e9 + (now.tv_nsec - b->host.tv_nsec);
+    printf("%-18s %2d %6d %10.1f %9.1f %10lld %6.1f\n", b->op, b->n, b->loops, host_ns / b->loops,
+            (double)(mk_sim_accesses() - b->accesses) / b->loops,
+            (long long)(ktime_get() - b->sim) / b->loops,
+            (double)(mk_sim_timer_expiries() - b->timers) / b->loops);
+}
+
+// n pads of one type, set up as mk_setup_pad() does
+static void bench_pads(enum mk_type type, int n, bool spi, bool paced) {
+    struct mk_pad *pad;
+    int i, b;
+
+    mk_sim_reset();
+    bsc_exit();
+    bsc_init();
+    mk_test_mk(&mk, bench_overruns);
+    mk.cfg.mux_paced = paced;
+    mk.cfg.hc165_spi = spi;
+    bench_now = 0;
+
+    for (i = 0; i < n; i++) {
+        pad = mk_test_mk_pad(&mk, i, type, BENCH_PERIOD);
+        switch (type) {
+        case MK_ARCADE_GPIO_MULTIPLEXER:
+            for (b = 0; b < 4; b++)
+                pad->gpio_maps[b] = bench_mux_addr[b];
+            pad->gpio_maps[4] = bench_mux_sig[i];
+            pad->button_count = 16;
+            pad->button_mask = MK_STATE_MASK(16);
+            mk_sim_mux_add(bench_mux_sig[i]);
+            break;
+        case MK_ARCADE_GPIO_74HC165:
+            pad->gpio_maps[0] = 17;
+            pad->gpio_maps[1] = spi ? SPI0_SCLK_GPIO : 22;
+            pad->gpio_maps[2] = spi ? SPI0_MISO_GPIO : 23;
+            pad->start_offs = i * BENCH_HC165_BUTTONS;
+            pad->button_count = BENCH_HC165_BUTTONS;
+            pad->button_mask = MK_STATE_MASK(BENCH_HC165_BUTTONS);
+            mk.hc165_bits = pad->start_offs + pad->button_count;
+            break;
+        case MK_ARCADE_MCP23017:
+            mk_sim_mcp23017_add(0x20 + i, -1, false);
+            pad->mcp23017addr = 0x20 + i;
+            pad->button_mask = MK_STATE_MASK(16);
+            mk_mcp23017_setup_xfer(pad, mk_mcp23017_complete);
+            mk_mcp23017_setup(pad, false);
+            break;
+        default:
+            memcpy(pad->gpio_maps, mk_arcade_gpio_maps, 13 * sizeof(int));
+            mk_setup_gpio_table(pad, 13);
+            break;
+        }
+    }
+
+    pad = &mk.pads[0];
+    if (type == MK_ARCADE_GPIO_MULTIPLEXER) {
+        mk.mux_start = 0;
+        mk.mux_end = 16;
+        mk_setup_mux_table(&mk, pad);
+        for (b = 0; b < 4; b++)
+            OUT_GPIO(bench_mux_addr[b]);
+        mk_sim_mux_setup(bench_mux_addr, BENCH_MUX_NS);
+    } else if (type == MK_ARCADE_GPIO_74HC165) {
+        mk_sim_hc165_setup(pad->gpio_maps[0], pad->gpio_maps[1], pad->gpio_maps[2], BENCH_HC165_NS);
+        mk_gpio_write(GPSET0, 1 << pad->gpio_maps[0]);
+        OUT_GPIO(pad->gpio_maps[0]);
+        if (spi) {
+            mk_74hc165_spi_init(BENCH_HC165_SPI_HZ);
+        } else {
+            OUT_GPIO(pad->gpio_maps[1]);
+        }
+    }
+}
+
+// One polling tick over all the pads, run until the scan or reads it started are done
+static void bench_tick(void) {
+    bench_now += BENCH_PERIOD;
+    mk_process_packet(&mk, bench_now);
+    while (mk.mux_timer.active || bsc_timer.active)
+        mk_sim_run_until(min(mk.mux_timer.active ? mk.mux_timer.expires : KTIME_MAX,
+                bsc_timer.active ? bsc_timer.expires : KTIME_MAX));
+}
+
+static void bench_ticks(const char *op, enum mk_type type, bool spi, bool paced) {
+    struct bench b;
+    int n, k;
+
+    for (n = 1; n <= MK_MAX_DEVICES; n++) {
+        bench_pads(type, n, spi, paced);
+        bench_begin(&b, op, n, BENCH_LOOPS);
+        for (k = 0; k < BENCH_LOOPS; k++)
+            bench_tick();
+        bench_end(&b);
+    }
+}
+
+static void bench_reads(void) {
+    struct mk_pad *pad = &mk.pads[0];
+    struct bench b;
+    u32 lev[16];
+    u64 chain = 0;
+    int k;
+
+    bench_pads(MK_ARCADE_GPIO, 1, false, false);
+    bench_begin(&b, "read_gpio", 1, BENCH_LOOPS);
+    for (k = 0; k < BENCH_LOOPS; k++)
+        mk_gpio_read_packet(pad, GPIO_LEV0);
+    bench_end(&b);
+
+    bench_pads(MK_ARCADE_GPIO_MULTIPLEXER, 1, false, false);
+    bench_begin(&b, "read_mux", 1, BENCH_LOOPS);
+    for (k = 0; k < BENCH_LOOPS; k++) {
+        mk_multiplexer_scan(&mk, lev, BENCH_MUX_NS);
+        mk_multiplexer_read_packet(pad, lev);
+    }
+    bench_end(&b);
+
+    bench_pads(MK_ARCADE_GPIO_74HC165, 1, false, false);
+    bench_begin(&b, "read_74hc165", 1, BENCH_LOOPS);
+    for (k = 0; k < BENCH_LOOPS; k++)
+        mk_74hc165_read_packet(pad, mk_74hc165_read_chain(pad, mk.hc165_bits, BENCH_HC165_NS));
+    bench_end(&b);
+
+    bench_pads(MK_ARCADE_GPIO_74HC165, 1, true, false);
+    bench_begin(&b, "read_74hc165_spi", 1, BENCH_LOOPS);
+    for (k = 0; k < BENCH_LOOPS; k++) {
+        mk_74hc165_spi_start(pad, mk.hc165_bits, BENCH_HC165_NS);
+        mk_74hc165_spi_finish(mk.hc165_bits, &chain);
+        mk_74hc165_read_packet(pad, chain);
+    }
+    bench_end(&b);
+
+    // a sleeping read of both ports, as when an interrupt mode pad is opened
+    bench_pads(MK_ARCADE_MCP23017, 1, false, false);
+    bench_begin(&b, "read_mcp23017", 1, BENCH_LOOPS / 10);
+    for (k = 0; k < BENCH_LOOPS / 10; k++)
+        mk_mcp23017_read_packet(pad);
+    bench_end(&b);
+}
+
+// n MCP23017 read one after the other, then queued in one batch with the address kept
+static void bench_i2c(void) {
+    struct bench b;
+    int n, i, k;
+
+    for (n = 1; n <= BENCH_MCP23017_MAX; n++) {
+        bench_pads(MK_ARCADE_MCP23017, n, false, false);
+        bench_begin(&b, "i2c_serial", n, BENCH_LOOPS / 10);
+        for (k = 0; k < BENCH_LOOPS / 10; k++) {
+            for (i = 0; i < n; i++)
+                mk_input_report(&mk.pads[i], mk_mcp23017_read_packet(&mk.pads[i]), ktime_get());
+        }
+        bench_end(&b);
+
+        bench_begin(&b, "i2c_batch", n, BENCH_LOOPS / 10);
+        for (k = 0; k < BENCH_LOOPS / 10; k++)
+            bench_tick();
+        bench_end(&b);
+    }
+}
+
+// Reporting one changed button, then every button and both axes
+static void bench_reports(void) {
+    struct mk_pad *pad = &mk.pads[0];
+    struct bench b;
+    int k;
+
+    bench_pads(MK_ARCADE_GPIO, 1, false, false);
+    bench_begin(&b, "report", 1, BENCH_LOOPS);
+    for (k = 0; k < BENCH_LOOPS; k++)
+        mk_input_report(pad, (k & 1) << MK_STATE_BTN_SHIFT, ktime_get());
+    bench_end(&b);
+
+    bench_begin(&b, "report", 14, BENCH_LOOPS);
+    for (k = 0; k < BENCH_LOOPS; k++)
+        mk_input_report(pad, (k & 1) ? 0xffff : 0, ktime_get());
+    bench_end(&b);
+}
+
+int main(void) {
+    printf("%-18s %2s %6s %10s %9s %10s %6s\n", "op", "n", "loops", "ns_per_op", "accesses", "sim_ns", "timers");
+    bench_reads();
+    bench_reports();
+    bench_ticks("tick_gpio", MK_ARCADE_GPIO, false, false);
+    bench_ticks("tick_mux", MK_ARCADE_GPIO_MULTIPLEXER, false, false);
+    bench_ticks("tick_mux_paced", MK_ARCADE_GPIO_MULTIPLEXER, false, true);
+    bench_ticks("tick_74hc165", MK_ARCADE_GPIO_74HC165, false, false);
+    bench_ticks("tick_74hc165_spi", MK_ARCADE_GPIO_74HC165, true, false);
+    bench_i2c();
+    return 0;
+}
@@ -0,0 +1,612 @@
+/*
+ * Simulated register banks and devices, see mk_sim.h
+ *
+ * The devices are modelled from their datasheets rather than from the driver's defines,
+ * so a wrong register address or bit in the driver shows up as a failed test.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mk_sim.h"
+#include "mk_hal.h"
+
+// BCM2835 BSC
+#define SIM_BSC_C_I2CEN		(1 << 15)
+#define SIM_BSC_C_ST		(1 << 7)
+#define SIM_BSC_C_CLEAR		(3 << 4)
+#define SIM_BSC_C_READ		(1 << 0)
+#define SIM_BSC_S_CLKT		(1 << 9)
+#define SIM_BSC_S_ERR		(1 << 8)
+#define SIM_BSC_S_RXF		(1 << 7)
+#define SIM_BSC_S_TXE		(1 << 6)
+#define SIM_BSC_S_RXD		(1 << 5)
+#define SIM_BSC_S_TXD		(1 << 4)
+#define SIM_BSC_S_DONE		(1 << 1)
+#define SIM_BSC_S_TA		(1 << 0)
+
+// BCM2835 SPI0
+#define SIM_SPI_CS_RXF		(1 << 20)
+#define SIM_SPI_CS_RXD		(1 << 17)
+#define SIM_SPI_CS_DONE		(1 << 16)
+#define SIM_SPI_CS_TA		(1 << 7)
+#define SIM_SPI_CS_CLEAR_RX	(1 << 5)
+#define SIM_SPI_CS_CLEAR_TX	(1 << 4)
+#define SIM_SPI_CS_CPOL		(1 << 3)
+#define SIM_SPI_CS_CPHA		(1 << 2)
+#define SIM_SPI_CORE_NS		4	// 250 MHz core clock
+#define SIM_SPI_SCLK		11
+#define SIM_SPI_MISO		9
+
+// GPIO functions
+#define SIM_FSEL_IN		0
+#define SIM_FSEL_OUT		1
+#define SIM_FSEL_ALT0		4
+
+// MCP23017 registers, IOCON.BANK = 0 addresses
+#define SIM_MCP_IODIRA		0x00
+#define SIM_MCP_IPOLA		0x02
+#define SIM_MCP_GPINTENA	0x04
+#define SIM_MCP_DEFVALA		0x06
+#define SIM_MCP_INTCONA		0x08
+#define SIM_MCP_IOCON		0x0a
+#define SIM_MCP_IOCON2		0x0b
+#define SIM_MCP_INTFA		0x0e
+#define SIM_MCP_INTCAPA		0x10
+#define SIM_MCP_GPIOA		0x12
+#define SIM_MCP_OLATA		0x14
+#define SIM_MCP_REGS		0x16
+#define SIM_MCP_IOCON_BANK	(1 << 7)
+#define SIM_MCP_IOCON_MIRROR	(1 << 6)
+#define SIM_MCP_IOCON_SEQOP	(1 << 5)
+#define SIM_MCP_IOCON_ODR	(1 << 2)
+#define SIM_MCP_IOCON_INTPOL	(1 << 1)
+
+struct mk_sim mk_sim;
+
+static void sim_irq_update(void);
+
+void mk_sim_reset(void) {
+    int i;
+
+    mk_sim_timers_reset();
+    memset(&mk_sim, 0, sizeof(mk_sim));
+    mk_sim_now = 0;
+    mk_sim.pins = ~0U;
+    for (i = 0; i < MK_SIM_MUXES; i++)
+        mk_sim.mux_in[i] = 0xffff;
+    mk_sim.hc165_ld_gpio = mk_sim.hc165_clk_gpio = mk_sim.hc165_qh_gpio = -1;
+    mk_sim.hc165_in = ~0ULL;
+    mk_sim.hc165_reg = ~0ULL;
+    mk_sim.hc165_ld = mk_sim.hc165_clk = true;
+}
+
+unsigned long mk_sim_accesses(void) {
+    return mk_sim.accesses[MK_SIM_GPIO] + mk_sim.accesses[MK_SIM_BSC1] + mk_sim.accesses[MK_SIM_SPI0];
+}
+
+/* GPIO */
+
+static int sim_fsel(int gpio) {
+    return (mk_sim.fsel[gpio / 10] >> ((gpio % 10) * 3)) & 7;
+}
+
+// The level the GPIO block drives on a pin, false on the pins which are not outputs
+static bool sim_out_level(int gpio) {
+    return gpio >= 0 && sim_fsel(gpio) == SIM_FSEL_OUT && ((mk_sim.out >> gpio) & 1);
+}
+
+static int sim_mux_visible(void) {
+    return mk_sim_now - mk_sim.mux_changed >= mk_sim.mux_settle_ns ? mk_sim.mux_addr : mk_sim.mux_prev;
+}
+
+static bool sim_hc165_qh(void) {
+    return (mk_sim.hc165_ld ? mk_sim.hc165_reg : mk_sim.hc165_in) & 1;
+}
+
+bool mk_sim_mcp23017_int_level(const struct mk_sim_mcp23017 *m) {
+    u8 iocon = m->reg[SIM_MCP_IOCON];
+    bool asserted = m->reg[SIM_MCP_INTFA] || ((iocon & SIM_MCP_IOCON_MIRROR) && m->reg[SIM_MCP_INTFA + 1]);
+
+    if (iocon & SIM_MCP_IOCON_ODR)
+        return !asserted;
+    return (iocon & SIM_MCP_IOCON_INTPOL) ? asserted : !asserted;
+}
+
+static u32 sim_levels(void) {
+    u32 lev = mk_sim.pins, outputs = 0;
+    int i;
+
+    for (i = 0; i < 32; i++) {
+        if (sim_fsel(i) == SIM_FSEL_OUT)
+            outputs |= 1U << i;
+    }
+    for (i = 0; i < mk_sim.mux_count; i++) {
+        if (!((mk_sim.mux_in[i] >> sim_mux_visible()) & 1))
+            lev &= ~(1U << mk_sim.mux_sig_gpio[i]);
+    }
+    if (mk_sim.hc165_qh_gpio >= 0 && !sim_hc165_qh())
+        lev &= ~(1U << mk_sim.hc165_qh_gpio);
+    for (i = 0; i < MK_SIM_MCP23017; i++) {
+        struct mk_sim_mcp23017 *m = &mk_sim.mcp23017[i];
+        if (m->present && m->int_gpio >= 0 && !mk_sim_mcp23017_int_level(m))
+            lev &= ~(1U << m->int_gpio);
+    }
+    return (lev & ~outputs) | (mk_sim.out & outputs);
+}
+
+void mk_sim_set_pins(u32 pins) {
+    mk_sim.pins = pins;
+    sim_irq_update();
+}
+
+void mk_sim_set_pin(int gpio, bool level) {
+    mk_sim_set_pins(level ? mk_sim.pins | (1U << gpio) : mk_sim.pins & ~(1U << gpio));
+}
+
+/* multiplexers */
+
+void mk_sim_mux_setup(const int *addr_gpios, unsigned int settle_ns) {
+    memcpy(mk_sim.mux_addr_gpio, addr_gpios, sizeof(mk_sim.mux_addr_gpio));
+    mk_sim.mux_settle_ns = settle_ns;
+}
+
+int mk_sim_mux_add(int sig_gpio) {
+    mk_sim.mux_sig_gpio[mk_sim.mux_count] = sig_gpio;
+    return mk_sim.mux_count++;
+}
+
+void mk_sim_mux_set(int mux, u16 levels) {
+    mk_sim.mux_in[mux] = levels;
+    sim_irq_update();
+}
+
+static void sim_mux_update(void) {
+    int b, addr = 0;
+
+    for (b = 0; b < 4; b++)
+        addr |= sim_out_level(mk_sim.mux_addr_gpio[b]) << b;
+    if (addr == mk_sim.mux_addr)
+        return;
+    mk_sim.mux_prev = sim_mux_visible();
+    mk_sim.mux_addr = addr;
+    mk_sim.mux_changed = mk_sim_now;
+}
+
+/* 74HC165 */
+
+void mk_sim_hc165_setup(int ld_gpio, int clk_gpio, int qh_gpio, unsigned int pulse_ns) {
+    mk_sim.hc165_ld_gpio = ld_gpio;
+    mk_sim.hc165_clk_gpio = clk_gpio;
+    mk_sim.hc165_qh_gpio = qh_gpio;
+    mk_sim.hc165_pulse_ns = pulse_ns;
+}
+
+void mk_sim_hc165_set(u64 levels) {
+    mk_sim.hc165_in = levels;
+}
+
+// A rising edge of CLK shifts the chain towards QH, the serial input of the last one is pulled up
+static void sim_hc165_clock(void) {
+    if (mk_sim.hc165_ld)
+        mk_sim.hc165_reg = (mk_sim.hc165_reg >> 1) | (1ULL << 63);
+}
+
+static void sim_hc165_update(void) {
+    // LD is pulled up until the Pi drives it
+    int ld_gpio = mk_sim.hc165_ld_gpio;
+    bool ld = ld_gpio < 0 || sim_fsel(ld_gpio) != SIM_FSEL_OUT || sim_out_level(ld_gpio);
+    bool clk = sim_out_level(mk_sim.hc165_clk_gpio);
+
+    if (mk_sim.hc165_ld && !ld)
+        mk_sim.hc165_ld_fall = mk_sim_now;
+    if (!mk_sim.hc165_ld && ld) {
+        // the inputs are loaded while LD is low, and held once it is back high
+        if (mk_sim_now - mk_sim.hc165_ld_fall < mk_sim.hc165_pulse_ns)
+            mk_sim.hc165_short++;
+        mk_sim.hc165_reg = mk_sim.hc165_in;
+    }
+    mk_sim.hc165_ld = ld;
+    if (!mk_sim.hc165_clk && clk)
+        sim_hc165_clock();
+    mk_sim.hc165_clk = clk;
+}
+
+static u32 sim_gpio_read(unsigned int reg) {
+    if (reg <= 0x14)
+        return mk_sim.fsel[reg / 4];
+    if (reg == GPLEV0) {
+        void (*after)(void *data) = mk_sim.after_lev;
+        u32 lev;
+
+        if (mk_sim.mux_count && mk_sim_now - mk_sim.mux_changed < mk_sim.mux_settle_ns)
+            mk_sim.mux_early++;
+        lev = sim_levels();
+        // once, and not again for the reads it does
+        if (after) {
+            mk_sim.after_lev = NULL;
+            after(mk_sim.after_lev_data);
+        }
+        return lev;
+    }
+    return 0;
+}
+
+static void sim_gpio_write(unsigned int reg, u32 val) {
+    if (reg <= 0x14)
+        mk_sim.fsel[reg / 4] = val;
+    else if (reg == GPSET0)
+        mk_sim.out |= val;
+    else if (reg == GPCLR0)
+        mk_sim.out &= ~val;
+    else
+        return;
+    sim_mux_update();
+    sim_hc165_update();
+}
+
+/* MCP23017 */
+
+struct mk_sim_mcp23017 *mk_sim_mcp23017(int addr) {
+    if (addr < 0x20 || addr >= 0x20 + MK_SIM_MCP23017 || !mk_sim.mcp23017[addr - 0x20].present)
+        return NULL;
+    return &mk_sim.mcp23017[addr - 0x20];
+}
+
+void mk_sim_mcp23017_add(int addr, int int_gpio, bool bank1) {
+    struct mk_sim_mcp23017 *m = &mk_sim.mcp23017[addr - 0x20];
+
+    memset(m, 0, sizeof(*m));
+    m->present = true;
+    m->int_gpio = int_gpio;
+    m->reg[SIM_MCP_IODIRA] = m->reg[SIM_MCP_IODIRA + 1] = 0xff;
+    // a chip left in BANK = 1 by a previous user, the power on default is BANK = 0
+    if (bank1)
+        m->reg[SIM_MCP_IOCON] = m->reg[SIM_MCP_IOCON2] = SIM_MCP_IOCON_BANK;
+    m->pins[0] = m->pins[1] = 0xff;
+}
+
+// Change the pin levels, and raise the interrupt of each port configured to catch the change
+void mk_sim_mcp23017_set(int addr, u8 gpa, u8 gpb) {
+    struct mk_sim_mcp23017 *m = mk_sim_mcp23017(addr);
+    u8 pins[2] = { gpa, gpb };
+    u8 fire, intcon;
+    int p;
+
+    for (p = 0; p < 2; p++) {
+        intcon = m->reg[SIM_MCP_INTCONA + p];
+        fire = ((pins[p] ^ m->reg[SIM_MCP_DEFVALA + p]) & intcon) | ((pins[p] ^ m->pins[p]) & ~intcon);
+        fire &= m->reg[SIM_MCP_GPINTENA + p] & m->reg[SIM_MCP_IODIRA + p];
+        // INTCAP holds the port at the first change, until the interrupt is cleared
+        if (fire && !m->reg[SIM_MCP_INTFA + p]) {
+            m->reg[SIM_MCP_INTFA + p] = fire;
+            m->reg[SIM_MCP_INTCAPA + p] = pins[p];
+        }
+        m->pins[p] = pins[p];
+    }
+    sim_irq_update();
+}
+
+static bool sim_mcp_bank1(const struct mk_sim_mcp23017 *m) {
+    return m->reg[SIM_MCP_IOCON] & SIM_MCP_IOCON_BANK;
+}
+
+// Set the register pointer from the address a write starts with
+static void sim_mcp_seek(struct mk_sim_mcp23017 *m, u8 addr) {
+    if (!sim_mcp_bank1(m)) {
+        if (addr < SIM_MCP_REGS)
+            m->ptr = addr;
+    } else if (addr <= 0x0a) {
+        m->ptr = addr * 2;
+    } else if (addr >= 0x10 && addr <= 0x1a) {
+        m->ptr = (addr - 0x10) * 2 + 1;
+    }
+}
+
+static void sim_mcp_advance(struct mk_sim_mcp23017 *m) {
+    bool bank1 = sim_mcp_bank1(m);
+
+    if (m->reg[SIM_MCP_IOCON] & SIM_MCP_IOCON_SEQOP) {
+        // byte mode : the pointer stays, or toggles between the A and B registers in BANK = 0
+        if (!bank1)
+            m->ptr ^= 1;
+    } else if (!bank1) {
+        m->ptr = (m->ptr + 1) % SIM_MCP_REGS;
+    } else {
+        // the registers of a port follow each other in BANK = 1
+        m->ptr = ((m->ptr / 2 + 1) % (SIM_MCP_REGS / 2)) * 2 + (m->ptr & 1);
+    }
+}
+
+static u8 sim_mcp_read(struct mk_sim_mcp23017 *m) {
+    u8 idx = m->ptr, val;
+
+    if (idx == SIM_MCP_GPIOA || idx == SIM_MCP_GPIOA + 1)
+        val = m->pins[idx & 1] ^ m->reg[SIM_MCP_IPOLA + (idx & 1)];
+    else
+        val = m->reg[idx];
+    // reading the port or its capture clears its interrupt
+    if (idx >= SIM_MCP_INTCAPA && idx <= SIM_MCP_GPIOA + 1)
+        m->reg[SIM_MCP_INTFA + (idx & 1)] = 0;
+    sim_mcp_advance(m);
+    return val;
+}
+
+static void sim_mcp_write(struct mk_sim_mcp23017 *m, u8 val) {
+    u8 idx = m->ptr;
+
+    if (idx == SIM_MCP_IOCON || idx == SIM_MCP_IOCON2)
+        m->reg[SIM_MCP_IOCON] = m->reg[SIM_MCP_IOCON2] = val & 0xfe;
+    else if (idx == SIM_MCP_GPIOA || idx == SIM_MCP_GPIOA + 1)
+        m->reg[SIM_MCP_OLATA + (idx & 1)] = val;
+    else if (idx < SIM_MCP_INTFA || idx > SIM_MCP_INTCAPA + 1)
+        m->reg[idx] = val;
+    sim_mcp_advance(m);
+}
+
+/* BSC1 : a transfer takes effect on the device as it ends */
+
+static void sim_bsc_sync(void) {
+    struct mk_sim_mcp23017 *m;
+    int i;
+
+    if (!mk_sim.bsc_active || mk_sim_now < mk_sim.bsc_end)
+        return;
+    mk_sim.bsc_active = false;
+    mk_sim.bsc_done = true;
+    m = mk_sim_mcp23017(mk_sim.bsc_a);
+    if (!m) {
+        mk_sim.bsc_err = true;
+        return;
+    }
+    if (mk_sim.bsc_read) {
+        mk_sim.bsc_fifo_head = 0;
+        mk_sim.bsc_fifo_len = min(mk_sim.bsc_dlen, 16U);
+        for (i = 0; i < mk_sim.bsc_fifo_len; i++)
+            mk_sim.bsc_fifo[i] = sim_mcp_read(m);
+    } else {
+        for (i = 0; i < mk_sim.bsc_dlen && mk_sim.bsc_fifo_len; i++) {
+            u8 val = mk_sim.bsc_fifo[mk_sim.bsc_fifo_head++];
+            mk_sim.bsc_fifo_len--;
+            if (i == 0)
+                sim_mcp_seek(m, val);
+            else
+                sim_mcp_write(m, val);
+        }
+    }
+    sim_irq_update();
+}
+
+static void sim_bsc_start(bool read) {
+    if (mk_sim.bsc_active)
+        return;
+    mk_sim.bsc_active = true;
+    mk_sim.bsc_read = read;
+    mk_sim.bsc_done = false;
+    mk_sim.bsc_xfers++;
+    // the address byte then the data, a missing device stops after the address
+    mk_sim.bsc_end = mk_sim_now + (u64)(1 + (mk_sim_mcp23017(mk_sim.bsc_a) ? mk_sim.bsc_dlen : 0)) * MK_SIM_BSC_BYTE_NS;
+}
+
+static u32 sim_bsc_read(unsigned int reg) {
+    u32 s = 0;
+
+    sim_bsc_sync();
+    switch (reg) {
+    case BSC_S:
+        if (mk_sim.bsc_active)
+            s |= SIM_BSC_S_TA;
+        if (mk_sim.bsc_done)
+            s |= SIM_BSC_S_DONE;
+        if (mk_sim.bsc_err)
+            s |= SIM_BSC_S_ERR;
+        if (mk_sim.bsc_read && mk_sim.bsc_fifo_len)
+            s |= SIM_BSC_S_RXD;
+        if (mk_sim.bsc_read && mk_sim.bsc_fifo_len == 16)
+            s |= SIM_BSC_S_RXF;
+        if (!mk_sim.bsc_fifo_len)
+            s |= SIM_BSC_S_TXE;
+        if (mk_sim.bsc_fifo_len < 16)
+            s |= SIM_BSC_S_TXD;
+        return s;
+    case BSC_FIFO:
+        if (!mk_sim.bsc_fifo_len)
+            return 0;
+        mk_sim.bsc_fifo_len--;
+        return mk_sim.bsc_fifo[mk_sim.bsc_fifo_head++];
+    case BSC_DLEN:
+        return mk_sim.bsc_dlen;
+    case BSC_A:
+        return mk_sim.bsc_a;
+    }
+    return 0;
+}
+
+static void sim_bsc_write(unsigned int reg, u32 val) {
+    sim_bsc_sync();
+    switch (reg) {
+    case BSC_C:
+        if (val & SIM_BSC_C_CLEAR)
+            mk_sim.bsc_fifo_head = mk_sim.bsc_fifo_len = 0;
+        if ((val & SIM_BSC_C_I2CEN) && (val & SIM_BSC_C_ST))
+            sim_bsc_start(val & SIM_BSC_C_READ);
+        break;
+    case BSC_S:
+        if (val & SIM_BSC_S_DONE)
+            mk_sim.bsc_done = false;
+        if (val & (SIM_BSC_S_ERR | SIM_BSC_S_CLKT))
+            mk_sim.bsc_err = false;
+        break;
+    case BSC_DLEN:
+        mk_sim.bsc_dlen = val & 0xffff;
+        break;
+    case BSC_A:
+        mk_sim.bsc_a = val & 0x7f;
+        break;
+    case BSC_FIFO:
+        if (!mk_sim.bsc_fifo_len)
+            mk_sim.bsc_fifo_head = 0;
+        if (mk_sim.bsc_fifo_head + mk_sim.bsc_fifo_len < 16)
+            mk_sim.bsc_fifo[mk_sim.bsc_fifo_head + mk_sim.bsc_fifo_len++] = val;
+        break;
+    }
+}
+
+/* SPI0, clocking the 74HC165 chain on SCLK and reading it on MISO */
+
+static u8 sim_spi_shift(void) {
+    // a 74HC165 shifts on the rising edge : with CPOL = 1, CPHA = 0 each bit is sampled
+    // on the falling edge before it, any other mode samples after the shift
+    bool before = (mk_sim.spi_cs & (SIM_SPI_CS_CPOL | SIM_SPI_CS_CPHA)) == SIM_SPI_CS_CPOL;
+    u8 rx = 0;
+    int b;
+
+    if (sim_fsel(SIM_SPI_SCLK) != SIM_FSEL_ALT0 || sim_fsel(SIM_SPI_MISO) != SIM_FSEL_ALT0)
+        return 0;
+    for (b = 7; b >= 0; b--) {
+        if (!before)
+            sim_hc165_clock();
+        rx |= sim_hc165_qh() << b;
+        if (before)
+            sim_hc165_clock();
+    }
+    return rx;
+}
+
+static u32 sim_spi_read(unsigned int reg) {
+    u32 cs;
+
+    switch (reg) {
+    case SPI_CS:
+        cs = mk_sim.spi_cs;
+        if ((cs & SIM_SPI_CS_TA) && mk_sim_now >= mk_sim.spi_end && !mk_sim.spi_stuck)
+            cs |= SIM_SPI_CS_DONE;
+        if (mk_sim.spi_rx_len && mk_sim_now >= mk_sim.spi_end)
+            cs |= SIM_SPI_CS_RXD;
+        if (mk_sim.spi_rx_len == 64)
+            cs |= SIM_SPI_CS_RXF;
+        return cs;
+    case SPI_FIFO:
+        if (!mk_sim.spi_rx_len)
+            return 0;
+        mk_sim.spi_rx_len--;
+        return mk_sim.spi_rx[mk_sim.spi_rx_head++];
+    case SPI_CLK:
+        return mk_sim.spi_clk;
+    }
+    return 0;
+}
+
+static void sim_spi_write(unsigned int reg, u32 val) {
+    u32 cdiv;
+
+    switch (reg) {
+    case SPI_CS:
+        if (val & SIM_SPI_CS_CLEAR_RX)
+            mk_sim.spi_rx_head = mk_sim.spi_rx_len = 0;
+        if ((val & SIM_SPI_CS_TA) && !(mk_sim.spi_cs & SIM_SPI_CS_TA))
+            mk_sim.spi_end = mk_sim_now;
+        mk_sim.spi_cs = val & ~(SIM_SPI_CS_CLEAR_RX | SIM_SPI_CS_CLEAR_TX);
+        break;
+    case SPI_FIFO:
+        if (!mk_sim.spi_rx_len)
+            mk_sim.spi_rx_head = 0;
+        if (!(mk_sim.spi_cs & SIM_SPI_CS_TA) || mk_sim.spi_rx_head + mk_sim.spi_rx_len >= 64)
+            break;
+        cdiv = mk_sim.spi_clk & 0xfffe;
+        mk_sim.spi_rx[mk_sim.spi_rx_head + mk_sim.spi_rx_len++] = sim_spi_shift();
+        mk_sim.spi_end = max(mk_sim.spi_end, mk_sim_now) + 8 * (cdiv ? cdiv : 65536) * SIM_SPI_CORE_NS;
+        mk_sim.spi_bytes++;
+        break;
+    case SPI_CLK:
+        mk_sim.spi_clk = val;
+        break;
+    }
+}
+
+/* MK_HAL_SIM accessors */
+
+u32 mk_sim_read(enum mk_sim_bank bank, unsigned int reg) {
+    mk_sim.accesses[bank]++;
+    switch (bank) {
+    case MK_SIM_GPIO:
+        return sim_gpio_read(reg);
+    case MK_SIM_BSC1:
+        return sim_bsc_read(reg);
+    case MK_SIM_SPI0:
+        return sim_spi_read(reg);
+    }
+    return 0;
+}
+
+void mk_sim_write(enum mk_sim_bank bank, unsigned int reg, u32 val) {
+    mk_sim.accesses[bank]++;
+    switch (bank) {
+    case MK_SIM_GPIO:
+        sim_gpio_write(reg, val);
+        break;
+    case MK_SIM_BSC1:
+        sim_bsc_write(reg, val);
+        break;
+    case MK_SIM_SPI0:
+        sim_spi_write(reg, val);
+        break;
+    }
+}
+
+/* interrupts */
+
+static enum hrtimer_restart sim_irq_fn(struct hrtimer *t) {
+    struct mk_sim_irq *irq = container_of(t, struct mk_sim_irq, timer);
+
+    irq->pending = false;
+    irq->running = true;
+    irq->again = false;
+    irq->handler(irq->gpio, irq->data);
+    irq->running = false;
+    // an edge seen while the handler ran runs it again, a level one is checked again
+    if (irq->again && !irq->pending) {
+        irq->pending = true;
+        hrtimer_start(&irq->timer, ns_to_ktime(mk_sim.irq_latency_ns), HRTIMER_MODE_REL);
+    }
+    sim_irq_update();
+    return HRTIMER_NORESTART;
+}
+
+static void sim_irq_update(void) {
+    u32 lev = sim_levels();
+    struct mk_sim_irq *irq;
+    bool level, want;
+    int i;
+
+    for (i = 0; i < mk_sim.irq_count; i++) {
+        irq = &mk_sim.irqs[i];
+        level = (lev >> irq->gpio) & 1;
+        want = irq->trigger == MK_SIM_IRQ_BOTH ? level != irq->level : !level;
+        irq->level = level;
+        if (!want || irq->pending)
+            continue;
+        if (irq->running) {
+            irq->again |= irq->trigger == MK_SIM_IRQ_BOTH;
+            continue;
+        }
+        irq->pending = true;
+        hrtimer_start(&irq->timer, ns_to_ktime(mk_sim.irq_latency_ns), HRTIMER_MODE_REL);
+    }
+}
+
+int mk_sim_request_irq(int gpio, enum mk_sim_trigger trigger, void (*handler)(int gpio, void *data), void *data) {
+    struct mk_sim_irq *irq;
+
+    if (mk_sim.irq_count == MK_SIM_IRQS)
+        return -EBUSY;
+    irq = &mk_sim.irqs[mk_sim.irq_count++];
+    irq->gpio = gpio;
+    irq->trigger = trigger;
+    irq->handler = handler;
+    irq->data = data;
+    irq->level = (sim_levels() >> gpio) & 1;
+    hrtimer_setup(&irq->timer, sim_irq_fn, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    sim_irq_update();
+    return 0;
+}
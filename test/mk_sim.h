@@ -0,0 +1,131 @@
+/*
+ * Simulated GPIO, BSC1 and SPI0 register banks, and the devices wired to them
+ *
+ * The buttons of the direct GPIO pads, 4-bit multiplexers sharing their address lines,
+ * a 74HC165 chain clocked from GPIOs or from SPI0, and MCP23017 expanders on BSC1.
+ * mk_sim_read() and mk_sim_write() are the backends of the MK_HAL_SIM accessors.
+ */
+
+#ifndef _MK_SIM_H
+#define _MK_SIM_H
+
+#include "kshim.h"
+
+#define MK_SIM_MUXES	9
+#define MK_SIM_MCP23017	8
+#define MK_SIM_IRQS	32
+
+// 9 clocks per byte at the 100 kHz the BSC1 runs at by default
+#define MK_SIM_BSC_BYTE_NS	90000
+
+enum mk_sim_trigger {
+    MK_SIM_IRQ_BOTH,    // on both edges, like the direct GPIO pads
+    MK_SIM_IRQ_LOW,     // while the line is low and not masked by a running handler, like a MCP23017 INT line
+};
+
+struct mk_sim_mcp23017 {
+    bool present;
+    u8 reg[0x16];   // in the IOCON.BANK = 0 order
+    u8 ptr;         // register pointer, in the same order
+    u8 pins[2];     // levels on GPA and GPB
+    int int_gpio;   // GPIO wired to INTA, -1 if none
+};
+
+struct mk_sim_irq {
+    int gpio;
+    enum mk_sim_trigger trigger;
+    void (*handler)(int gpio, void *data);
+    void *data;
+    struct hrtimer timer;
+    bool level;
+    bool pending;
+    bool running;
+    bool again;
+};
+
+struct mk_sim {
+    // GPIO : levels of the input pins, without what the devices drive
+    u32 fsel[6];
+    u32 out;
+    u32 pins;
+    // multiplexers sharing 4 address lines, each one on its own signal pin
+    int mux_count;
+    int mux_addr_gpio[4];
+    int mux_sig_gpio[MK_SIM_MUXES];
+    u16 mux_in[MK_SIM_MUXES];       // channel levels, a pressed button is low
+    unsigned int mux_settle_ns;
+    int mux_addr;
+    int mux_prev;
+    ktime_t mux_changed;
+    unsigned long mux_early;        // level reads before the address settled
+    // 74HC165 chain
+    int hc165_ld_gpio;
+    int hc165_clk_gpio;
+    int hc165_qh_gpio;
+    u64 hc165_in;                   // parallel inputs, the first bit out in bit 0
+    u64 hc165_reg;
+    bool hc165_ld;
+    bool hc165_clk;
+    ktime_t hc165_ld_fall;
+    unsigned int hc165_pulse_ns;    // shortest LD pulse the chain takes
+    unsigned long hc165_short;      // LD pulses shorter than that
+    // BSC1
+    u32 bsc_dlen;
+    u32 bsc_a;
+    u8 bsc_fifo[16];
+    int bsc_fifo_head;
+    int bsc_fifo_len;
+    bool bsc_active;
+    bool bsc_read;
+    bool bsc_done;
+    bool bsc_err;
+    ktime_t bsc_end;
+    unsigned long bsc_xfers;
+    struct mk_sim_mcp23017 mcp23017[MK_SIM_MCP23017];
+    // SPI0
+    u32 spi_cs;
+    u32 spi_clk;
+    u8 spi_rx[64];
+    int spi_rx_head;
+    int spi_rx_len;
+    ktime_t spi_end;
+    bool spi_stuck;                 // never raises DONE
+    unsigned long spi_bytes;
+    // interrupts, delivered irq_latency_ns after the line changes
+    struct mk_sim_irq irqs[MK_SIM_IRQS];
+    int irq_count;
+    unsigned int irq_latency_ns;
+    // called once right after the next GPLEV0 read, an interrupt landing just after a snapshot
+    void (*after_lev)(void *data);
+    void *after_lev_data;
+    // register accesses, per bank
+    unsigned long accesses[3];
+};
+
+extern struct mk_sim mk_sim;
+
+void mk_sim_reset(void);
+unsigned long mk_sim_accesses(void);
+
+void mk_sim_set_pins(u32 pins);
+void mk_sim_set_pin(int gpio, bool level);
+
+void mk_sim_mux_setup(const int *addr_gpios, unsigned int settle_ns);
+int mk_sim_mux_add(int sig_gpio);
+void mk_sim_mux_set(int mux, u16 levels);
+
+void mk_sim_hc165_setup(int ld_gpio, int clk_gpio, int qh_gpio, unsigned int pulse_ns);
+void mk_sim_hc165_set(u64 levels);
+
+void mk_sim_mcp23017_add(int addr, int int_gpio, bool bank1);
+void mk_sim_mcp23017_set(int addr, u8 gpa, u8 gpb);
+struct mk_sim_mcp23017 *mk_sim_mcp23017(int addr);
+bool mk_sim_mcp23017_int_level(const struct mk_sim_mcp23017 *m);
+
+int mk_sim_request_irq(int gpio, enum mk_sim_trigger trigger, void (*handler)(int gpio, void *data), void *data);
+
+// the timers of kshim.c, mk_sim_reset() forgets them
+void mk_sim_timers_reset(void);
+unsigned long mk_sim_timer_expiries(void);
+
+#endif
@@ -0,0 +1,110 @@
+/*
+ * The backend headers built for the host against the simulated registers, and the checks of the tests
+ */
+
+#ifndef _MK_TEST_H
+#define _MK_TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "kshim.h"
+#include "mk_sim.h"
+
+#include "mk_hal.h"
+#include "mk_bsc.h"
+#include "mk_arcade.h"
+#include "mk_arcade_gpio.h"
+#include "MCP23017.h"
+#include "Multiplexer.h"
+#include "74HC165.h"
+#include "mk_poll.h"
+
+static int mk_test_failed;
+
+// The reports of mk_input_report(), in place of /dev/am_arcade
+struct mk_test_report {
+    int idx;
+    u32 state;
+    ktime_t sampled;
+    ktime_t time;
+};
+
+#define MK_TEST_REPORTS	1024
+
+static struct mk_test_report mk_test_reports[MK_TEST_REPORTS];
+static int mk_test_report_count;
+
+static void mk_cdev_update(struct mk_pad * pad, u32 state, ktime_t sampled) {
+    if (mk_test_report_count < MK_TEST_REPORTS)
+        mk_test_reports[mk_test_report_count++] = (struct mk_test_report) { pad->idx, state, sampled, ktime_get() };
+}
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #cond); \
+        mk_test_failed++; \
+    } \
+} while (0)
+
+#define CHECK_EQ(a, b) do { \
+    unsigned long long _a = (a), _b = (b); \
+    if (_a != _b) { \
+        fprintf(stderr, "%s:%d: %s: check failed: %s == %s (0x%llx != 0x%llx)\n", \
+                __FILE__, __LINE__, __func__, #a, #b, _a, _b); \
+        mk_test_failed++; \
+    } \
+} while (0)
+
+// Run a test on a fresh simulation, with the BSC engine set up again
+#define RUN(test) do { \
+    int _failed = mk_test_failed; \
+    mk_sim_reset(); \
+    mk_test_report_count = 0; \
+    bsc_exit(); \
+    bsc_init(); \
+    test(); \
+    printf("%s %s\n", mk_test_failed == _failed ? "PASS" : "FAIL", #test); \
+} while (0)
+
+static inline int mk_test_result(void) {
+    return mk_test_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// A pad as mk_setup_pad() leaves it for the backend reads
+static inline void mk_test_pad(struct mk_pad *pad, int idx, enum mk_type type) {
+    memset(pad, 0, sizeof(*pad));
+    pad->idx = idx;
+    pad->type = type;
+    pad->open = true;
+}
+
+static struct input_dev mk_test_devs[MK_MAX_DEVICES];
+
+// The pads of mk, reported through mk_input_report() with the polling settings of the module defaults
+static inline void mk_test_mk(struct mk *mk, unsigned long *class_overruns) {
+    int i;
+
+    memset(mk, 0, sizeof(*mk));
+    mk->cfg.debounce_n = 3;
+    mk->cfg.mux_ns = 5000;
+    mk->cfg.hc165_ns = 50;
+    mk->class_overruns = class_overruns;
+    hrtimer_setup(&mk->mux_timer, mk_mux_timer, CLOCK_MONOTONIC, MK_HRTIMER_MODE_REL);
+    for (i = 0; i < MK_MAX_DEVICES; i++) {
+        mk->pads[i].dev = &mk_test_devs[i];
+        input_set_drvdata(&mk_test_devs[i], mk);
+    }
+}
+
+// A pad of mk, polled every period
+static inline struct mk_pad *mk_test_mk_pad(struct mk *mk, int idx, enum mk_type type, ktime_t period) {
+    struct mk_pad *pad = &mk->pads[idx];
+
+    mk_test_pad(pad, idx, type);
+    pad->dev = &mk_test_devs[idx];
+    pad->period = period;
+    return pad;
+}
+
+#endif
@@ -0,0 +1,173 @@
+/*
+ * 74HC165 pads, on a simulated chain clocked from GPIOs or shifted through SPI0
+ */
+
+#include "mk_test.h"
+
+#define LD	16
+#define CLK	20
+#define QH	21
+
+static void hc165_pad(struct mk_pad *pad, int idx, int start, int count) {
+    mk_test_pad(pad, idx, MK_ARCADE_GPIO_74HC165);
+    pad->gpio_maps[0] = LD;
+    pad->gpio_maps[1] = CLK;
+    pad->gpio_maps[2] = QH;
+    pad->start_offs = start;
+    pad->button_count = count;
+    pad->button_mask = MK_STATE_MASK(count);
+}
+
+// LD idles high and CLK low, both driven by the Pi
+static void hc165_setup(unsigned int pulse_ns) {
+    mk_sim_hc165_setup(LD, CLK, QH, pulse_ns);
+    mk_gpio_write(GPSET0, 1 << LD);
+    OUT_GPIO(LD);
+    OUT_GPIO(CLK);
+}
+
+// The first bit out is the one next to QH, a pressed button is low
+static void test_hc165_chain(void) {
+    static const u64 levels[] = { ~0ULL, 0, 0xfffe, 0x7fff, 0xa5c3, 0x1234 };
+    struct mk_pad pad;
+    int i;
+
+    hc165_pad(&pad, 0, 0, 16);
+    hc165_setup(50);
+    for (i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+        mk_sim_hc165_set(levels[i]);
+        CHECK_EQ(mk_74hc165_read_chain(&pad, 16, 50), levels[i] & 0xffff);
+        CHECK_EQ(mk_74hc165_read_packet(&pad, levels[i]), ~levels[i] & 0xffff);
+    }
+    CHECK_EQ(mk_sim.hc165_short, 0);
+}
+
+// Every bit of a 64 input chain
+static void test_hc165_chain_64(void) {
+    struct mk_pad pad;
+    int i;
+
+    hc165_pad(&pad, 0, 0, 32);
+    hc165_setup(50);
+    for (i = 0; i < 64; i++) {
+        mk_sim_hc165_set(~(1ULL << i));
+        CHECK_EQ(mk_74hc165_read_chain(&pad, 64, 50), ~(1ULL << i));
+    }
+}
+
+// The pads sharing the chain take their own window of it from one shift
+static void test_hc165_shared(void) {
+    struct mk_pad pads[2];
+    u64 chain;
+
+    hc165_pad(&pads[0], 0, 0, 8);
+    hc165_pad(&pads[1], 1, 8, 12);
+    hc165_setup(50);
+    mk_sim_hc165_set(~((1ULL << 3) | (1ULL << 8) | (1ULL << 19) | (1ULL << 20)));
+    chain = mk_74hc165_read_chain(&pads[0], 20, 50);
+    CHECK_EQ(mk_74hc165_read_packet(&pads[0], chain), 1U << 3);
+    CHECK_EQ(mk_74hc165_read_packet(&pads[1], chain), (1U << 0) | (1U << 11));
+}
+
+// Each read latches the inputs again
+static void test_hc165_latch(void) {
+    struct mk_pad pad;
+
+    hc165_pad(&pad, 0, 0, 16);
+    hc165_setup(50);
+    mk_sim_hc165_set(0xfffe);
+    CHECK_EQ(mk_74hc165_read_chain(&pad, 8, 50), 0xfe);
+    mk_sim_hc165_set(0xffff);
+    CHECK_EQ(mk_74hc165_read_chain(&pad, 8, 50), 0xff);
+}
+
+// A LD pulse shorter than the chain needs is caught by the model
+static void test_hc165_pulse(void) {
+    struct mk_pad pad;
+
+    hc165_pad(&pad, 0, 0, 16);
+    hc165_setup(100);
+    mk_74hc165_read_chain(&pad, 16, 100);
+    CHECK_EQ(mk_sim.hc165_short, 0);
+    mk_74hc165_read_chain(&pad, 16, 20);
+    CHECK_EQ(mk_sim.hc165_short, 1);
+}
+
+// SPI0 clocks the chain on SCLK and reads it on MISO, LD stays on a GPIO
+static void hc165_spi_setup(unsigned int hz) {
+    mk_sim_hc165_setup(LD, SPI0_SCLK_GPIO, SPI0_MISO_GPIO, 50);
+    mk_gpio_write(GPSET0, 1 << LD);
+    OUT_GPIO(LD);
+    mk_74hc165_spi_init(hz);
+}
+
+// The FIFO gives the same chain as the GPIO shift, for whole and partial words
+static void test_hc165_spi_chain(void) {
+    static const int bits[] = { 8, 16, 24, 64 };
+    static const u64 levels[] = { ~0ULL, 0, ~1ULL, 0x7fffffffffffffffULL, 0xa5c3f00f12345678ULL };
+    struct mk_pad pad;
+    u64 chain, mask;
+    int b, i;
+
+    hc165_pad(&pad, 0, 0, 16);
+    hc165_spi_setup(8000000);
+    for (b = 0; b < sizeof(bits) / sizeof(bits[0]); b++) {
+        mask = bits[b] == 64 ? ~0ULL : (1ULL << bits[b]) - 1;
+        for (i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+            mk_sim_hc165_set(levels[i]);
+            mk_74hc165_spi_start(&pad, bits[b], 50);
+            CHECK_EQ(mk_74hc165_spi_finish(bits[b], &chain), 0);
+            CHECK_EQ(chain, levels[i] & mask);
+        }
+    }
+    CHECK_EQ(mk_sim.hc165_short, 0);
+}
+
+// The shift runs on its own : starting it costs the LD pulse, the 64 bits take 8 us at 8 MHz
+static void test_hc165_spi_timing(void) {
+    struct mk_pad pad;
+    ktime_t start, started;
+    u64 chain;
+
+    hc165_pad(&pad, 0, 0, 16);
+    hc165_spi_setup(8000000);
+    start = ktime_get();
+    mk_74hc165_spi_start(&pad, 64, 50);
+    started = ktime_get();
+    CHECK(started - start < 1000);
+    CHECK_EQ(mk_74hc165_spi_finish(64, &chain), 0);
+    // a divider of 32 : 7.8 MHz, 1024 ns per byte
+    CHECK(ktime_get() - started >= 8 * 1024);
+    CHECK(ktime_get() - started < 8 * 1024 + 2 * MK_SIM_RELAX_NS);
+    CHECK_EQ(mk_sim.spi_bytes, 8);
+}
+
+// A shift that never ends gives up and stops the transfer, the next one works again
+static void test_hc165_spi_timeout(void) {
+    struct mk_pad pad;
+    u64 chain = 0;
+
+    hc165_pad(&pad, 0, 0, 16);
+    hc165_spi_setup(8000000);
+    mk_sim_hc165_set(0xfffe);
+    mk_sim.spi_stuck = true;
+    mk_74hc165_spi_start(&pad, 16, 50);
+    CHECK_EQ(mk_74hc165_spi_finish(16, &chain), -ETIMEDOUT);
+    CHECK(!(mk_sim.spi_cs & SPI_CS_TA));
+    mk_sim.spi_stuck = false;
+    mk_74hc165_spi_start(&pad, 16, 50);
+    CHECK_EQ(mk_74hc165_spi_finish(16, &chain), 0);
+    CHECK_EQ(chain, 0xfffe);
+}
+
+int main(void) {
+    RUN(test_hc165_chain);
+    RUN(test_hc165_chain_64);
+    RUN(test_hc165_shared);
+    RUN(test_hc165_latch);
+    RUN(test_hc165_pulse);
+    RUN(test_hc165_spi_chain);
+    RUN(test_hc165_spi_timing);
+    RUN(test_hc165_spi_timeout);
+    return mk_test_result();
+}
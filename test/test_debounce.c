@@ -0,0 +1,130 @@
+/*
+ * Debounce of the polled pads, with the vertical counters of mk_poll.h
+ */
+
+#include "mk_test.h"
+
+// One poll of raw, reported as mk_input_report() does
+static u32 poll(struct mk_pad *pad, u32 raw, int mode, int n) {
+    pad->state = mk_debounce(pad, raw, mode, n);
+    return pad->state;
+}
+
+static void debounce_pad(struct mk_pad *pad) {
+    mk_test_pad(pad, 0, MK_ARCADE_GPIO);
+    pad->button_mask = 0x1fff;
+}
+
+// Without debounce every sample is reported as read
+static void test_debounce_off(void) {
+    struct mk_pad pad;
+
+    debounce_pad(&pad);
+    CHECK_EQ(poll(&pad, 0x1, MK_DEBOUNCE_OFF, 3), 0x1);
+    CHECK_EQ(poll(&pad, 0x0, MK_DEBOUNCE_OFF, 3), 0x0);
+    CHECK_EQ(poll(&pad, 0x1fff, MK_DEBOUNCE_OFF, 3), 0x1fff);
+}
+
+// An edge is reported at once, then the button is ignored for n polls
+static void test_debounce_eager_lockout(void) {
+    struct mk_pad pad;
+    int n, i;
+
+    for (n = 1; n <= 7; n++) {
+        debounce_pad(&pad);
+        CHECK_EQ(poll(&pad, 0x1, MK_DEBOUNCE_EAGER, n), 0x1);
+        for (i = 1; i <= n; i++)
+            CHECK_EQ(poll(&pad, 0x0, MK_DEBOUNCE_EAGER, n), 0x1);
+        CHECK_EQ(poll(&pad, 0x0, MK_DEBOUNCE_EAGER, n), 0x0);
+        // the release locks the button out in turn
+        for (i = 1; i <= n; i++)
+            CHECK_EQ(poll(&pad, 0x1, MK_DEBOUNCE_EAGER, n), 0x0);
+        CHECK_EQ(poll(&pad, 0x1, MK_DEBOUNCE_EAGER, n), 0x1);
+    }
+}
+
+// A press bouncing during the lockout gives one press, and the state it settled in
+static void test_debounce_eager_bounce(void) {
+    static const u32 bounce[] = { 0x1, 0x0, 0x1, 0x0, 0x1, 0x1, 0x1 };
+    struct mk_pad pad;
+    u32 prev = 0;
+    int i, edges = 0;
+
+    debounce_pad(&pad);
+    for (i = 0; i < sizeof(bounce) / sizeof(bounce[0]); i++) {
+        edges += poll(&pad, bounce[i], MK_DEBOUNCE_EAGER, 4) != prev;
+        prev = pad.state;
+    }
+    CHECK_EQ(edges, 1);
+    CHECK_EQ(pad.state, 0x1);
+}
+
+// A change is reported once it was read n polls in a row
+static void test_debounce_deferred_stable(void) {
+    struct mk_pad pad;
+    int n, i;
+
+    for (n = 1; n <= 7; n++) {
+        debounce_pad(&pad);
+        for (i = 1; i < n; i++)
+            CHECK_EQ(poll(&pad, 0x1, MK_DEBOUNCE_DEFERRED, n), 0x0);
+        CHECK_EQ(poll(&pad, 0x1, MK_DEBOUNCE_DEFERRED, n), 0x1);
+        for (i = 1; i < n; i++)
+            CHECK_EQ(poll(&pad, 0x0, MK_DEBOUNCE_DEFERRED, n), 0x1);
+        CHECK_EQ(poll(&pad, 0x0, MK_DEBOUNCE_DEFERRED, n), 0x0);
+    }
+}
+
+// A change shorter than n polls is dropped, and the count starts again after it
+static void test_debounce_deferred_glitch(void) {
+    struct mk_pad pad;
+    int n, i;
+
+    for (n = 2; n <= 7; n++) {
+        debounce_pad(&pad);
+        for (i = 1; i < n; i++)
+            CHECK_EQ(poll(&pad, 0x1, MK_DEBOUNCE_DEFERRED, n), 0x0);
+        CHECK_EQ(poll(&pad, 0x0, MK_DEBOUNCE_DEFERRED, n), 0x0);
+        for (i = 1; i < n; i++)
+            CHECK_EQ(poll(&pad, 0x1, MK_DEBOUNCE_DEFERRED, n), 0x0);
+        CHECK_EQ(poll(&pad, 0x1, MK_DEBOUNCE_DEFERRED, n), 0x1);
+    }
+}
+
+// Each button has its own counter
+static void test_debounce_buttons(void) {
+    struct mk_pad pad;
+
+    debounce_pad(&pad);
+    CHECK_EQ(poll(&pad, 0x1, MK_DEBOUNCE_DEFERRED, 3), 0x0);
+    CHECK_EQ(poll(&pad, 0x3, MK_DEBOUNCE_DEFERRED, 3), 0x0);
+    CHECK_EQ(poll(&pad, 0x3, MK_DEBOUNCE_DEFERRED, 3), 0x1);
+    CHECK_EQ(poll(&pad, 0x3, MK_DEBOUNCE_DEFERRED, 3), 0x3);
+
+    debounce_pad(&pad);
+    CHECK_EQ(poll(&pad, 0x1, MK_DEBOUNCE_EAGER, 2), 0x1);
+    CHECK_EQ(poll(&pad, 0x2, MK_DEBOUNCE_EAGER, 2), 0x3);
+    CHECK_EQ(poll(&pad, 0x0, MK_DEBOUNCE_EAGER, 2), 0x3);
+    CHECK_EQ(poll(&pad, 0x0, MK_DEBOUNCE_EAGER, 2), 0x2);
+    CHECK_EQ(poll(&pad, 0x0, MK_DEBOUNCE_EAGER, 2), 0x0);
+
+    // all 32 bits of the state at once
+    debounce_pad(&pad);
+    CHECK_EQ(poll(&pad, ~0U, MK_DEBOUNCE_DEFERRED, 7), 0);
+    CHECK_EQ(poll(&pad, ~0U, MK_DEBOUNCE_DEFERRED, 7), 0);
+    CHECK_EQ(poll(&pad, ~0U, MK_DEBOUNCE_DEFERRED, 7), 0);
+    CHECK_EQ(poll(&pad, ~0U, MK_DEBOUNCE_DEFERRED, 7), 0);
+    CHECK_EQ(poll(&pad, ~0U, MK_DEBOUNCE_DEFERRED, 7), 0);
+    CHECK_EQ(poll(&pad, ~0U, MK_DEBOUNCE_DEFERRED, 7), 0);
+    CHECK_EQ(poll(&pad, ~0U, MK_DEBOUNCE_DEFERRED, 7), ~0U);
+}
+
+int main(void) {
+    RUN(test_debounce_off);
+    RUN(test_debounce_eager_lockout);
+    RUN(test_debounce_eager_bounce);
+    RUN(test_debounce_deferred_stable);
+    RUN(test_debounce_deferred_glitch);
+    RUN(test_debounce_buttons);
+    return mk_test_result();
+}
@@ -0,0 +1,147 @@
+/*
+ * Direct GPIO pads
+ */
+
+#include "mk_test.h"
+
+static void gpio_pad(struct mk_pad *pad, int idx, const int *maps) {
+    mk_test_pad(pad, idx, MK_ARCADE_GPIO);
+    memcpy(pad->gpio_maps, maps, 13 * sizeof(int));
+    mk_setup_gpio_table(pad, 13);
+}
+
+// Each button is read from its own pin, a pressed one is low
+static void test_gpio_maps(void) {
+    struct mk_pad pad;
+    int i;
+
+    gpio_pad(&pad, 0, mk_arcade_gpio_maps);
+    CHECK_EQ(pad.button_mask, 0x1fff);
+    CHECK_EQ(mk_gpio_read_packet(&pad, GPIO_LEV0), 0);
+    for (i = 0; i < 13; i++) {
+        mk_sim_set_pins(~(1U << mk_arcade_gpio_maps[i]));
+        CHECK_EQ(mk_gpio_read_packet(&pad, GPIO_LEV0), 1U << i);
+    }
+    mk_sim_set_pins(~((1U << mk_arcade_gpio_maps[0]) | (1U << mk_arcade_gpio_maps[12])));
+    CHECK_EQ(mk_gpio_read_packet(&pad, GPIO_LEV0), 0x1001);
+}
+
+// Unused pins, and the ones outside of GPLEV0, never read as pressed
+static void test_gpio_unused_pins(void) {
+    static const int maps[] = { 4, -1, 27, 40, 10, 9, 25, 24, 23, 18, 15, 14, -1 };
+    struct mk_pad pad;
+
+    gpio_pad(&pad, 0, maps);
+    CHECK_EQ(pad.button_mask, 0xff5);
+    mk_sim_set_pins(0);
+    CHECK_EQ(mk_gpio_read_packet(&pad, GPIO_LEV0), pad.button_mask);
+}
+
+// Both GPIO pads come from one level register read
+static void test_gpio_snapshot(void) {
+    struct mk_pad pads[2];
+    unsigned long accesses;
+    u32 gplev0;
+
+    gpio_pad(&pads[0], 0, mk_arcade_gpio_maps);
+    gpio_pad(&pads[1], 1, mk_arcade_gpio_maps_bplus);
+    mk_sim_set_pins(~((1U << mk_arcade_gpio_maps[6]) | (1U << mk_arcade_gpio_maps_bplus[7])));
+
+    accesses = mk_sim_accesses();
+    gplev0 = GPIO_LEV0;
+    CHECK_EQ(mk_gpio_read_packet(&pads[0], gplev0), 1U << 6);
+    CHECK_EQ(mk_gpio_read_packet(&pads[1], gplev0), 1U << 7);
+    CHECK_EQ(mk_sim_accesses() - accesses, 1);
+}
+
+/*
+ * Press to event latency, the time from a press on a pin to the report of mk_input_report().
+ * A polled pad is read by mk_process_packet() every poll period, from a timer as mk_timer()
+ * runs it, an interrupt mode one by mk_gpio_irq_report() on the edge, which runs after the
+ * interrupt latency of the simulation.
+ */
+
+#define POLL_NS		10000000	// the 100 Hz default of poll_hz
+#define IRQ_NS		50000		// edge to threaded handler
+#define PRESSES		200
+
+static struct mk latency_mk;
+static unsigned long latency_overruns[MK_MAX];
+
+static enum hrtimer_restart latency_tick(struct hrtimer *t) {
+    mk_process_packet(&latency_mk, hrtimer_get_expires(t));
+    hrtimer_forward_now(t, ns_to_ktime(POLL_NS));
+    return HRTIMER_RESTART;
+}
+
+static void latency_irq(int gpio, void *data) {
+    mk_gpio_irq_report(data);
+}
+
+// Press the buttons one after the other at pseudo random times, and return the worst latency
+static s64 latency_run(const char *mode, s64 *avg) {
+    u32 seed = 12345;
+    s64 total = 0, worst = 0, latency;
+    ktime_t press;
+    int i, button;
+
+    for (i = 0; i < PRESSES; i++) {
+        seed = seed * 1103515245 + 12345;
+        button = (seed >> 16) % 13;
+        press = ktime_get() + 20000000 + (seed >> 8) % POLL_NS;
+        mk_sim_run_until(press);
+        mk_test_report_count = 0;
+        mk_sim_set_pin(mk_arcade_gpio_maps[button], 0);
+        // held for 50 ms, longer than a poll
+        mk_sim_run_until(press + 50000000);
+        mk_sim_set_pin(mk_arcade_gpio_maps[button], 1);
+        CHECK_EQ(mk_test_report_count, 1);
+        CHECK_EQ(mk_test_reports[0].state, 1U << button);
+        latency = mk_test_reports[0].time - press;
+        total += latency;
+        worst = max(worst, latency);
+    }
+    *avg = total / PRESSES;
+    printf("latency %-7s avg %8lld ns max %8lld ns\n", mode, (long long)*avg, (long long)worst);
+    return worst;
+}
+
+static void test_gpio_latency(void) {
+    struct hrtimer timer;
+    struct mk_pad *pad;
+    s64 poll_avg, poll_max, irq_avg, irq_max;
+    int i;
+
+    mk_test_mk(&latency_mk, latency_overruns);
+    pad = mk_test_mk_pad(&latency_mk, 0, MK_ARCADE_GPIO, POLL_NS);
+    memcpy(pad->gpio_maps, mk_arcade_gpio_maps, 13 * sizeof(int));
+    mk_setup_gpio_table(pad, 13);
+
+    hrtimer_setup(&timer, latency_tick, CLOCK_MONOTONIC, MK_HRTIMER_MODE);
+    hrtimer_start(&timer, ns_to_ktime(POLL_NS), MK_HRTIMER_MODE);
+    poll_max = latency_run("polled", &poll_avg);
+    hrtimer_cancel(&timer);
+
+    // with irq=1 the pad has one interrupt per pin, and is not polled anymore
+    mk_sim.irq_latency_ns = IRQ_NS;
+    for (i = 0; i < 13; i++)
+        CHECK_EQ(mk_sim_request_irq(mk_arcade_gpio_maps[i], MK_SIM_IRQ_BOTH, latency_irq, pad), 0);
+    pad->irq_count = 13;
+    CHECK(!mk_pad_polled(pad));
+    irq_max = latency_run("irq", &irq_avg);
+
+    // a polled press waits for the next tick, half a period on average
+    CHECK(poll_max <= POLL_NS);
+    CHECK(poll_avg > POLL_NS / 4 && poll_avg < 3 * POLL_NS / 4);
+    // an interrupt mode one only for the handler
+    CHECK_EQ(irq_max, IRQ_NS);
+    CHECK_EQ(irq_avg, IRQ_NS);
+}
+
+int main(void) {
+    RUN(test_gpio_maps);
+    RUN(test_gpio_unused_pins);
+    RUN(test_gpio_snapshot);
+    RUN(test_gpio_latency);
+    return mk_test_result();
+}
@@ -0,0 +1,277 @@
+/*
+ * MCP23017 pads, on the BSC engine and a simulated expander
+ */
+
+#include "mk_test.h"
+
+static int done_count;
+static int done_err;
+static u32 done_raw[MK_MAX_DEVICES];
+
+static void mcp_done(struct bsc_xfer *xfer) {
+    struct mk_pad *pad = container_of(xfer, struct mk_pad, xfer);
+
+    done_count++;
+    done_err = xfer->err;
+    if (!xfer->err)
+        done_raw[pad->idx] = mk_mcp23017_decode(pad, pad->i2c_buf[0], pad->i2c_buf[1]);
+}
+
+static void mcp_pad(struct mk_pad *pad, int idx, int addr, bool int_line) {
+    mk_test_pad(pad, idx, MK_ARCADE_MCP23017);
+    pad->mcp23017addr = addr;
+    pad->button_mask = MK_STATE_MASK(16);
+    mk_mcp23017_setup_xfer(pad, mcp_done);
+    mk_mcp23017_setup(pad, int_line);
+    done_count = 0;
+}
+
+// Both ports are inputs with their pullups, left in byte mode for the polled reads
+static void test_mcp23017_setup(void) {
+    struct mk_sim_mcp23017 *m;
+    struct mk_pad pad;
+
+    mk_sim_mcp23017_add(0x20, -1, false);
+    mcp_pad(&pad, 0, 0x20, false);
+    m = mk_sim_mcp23017(0x20);
+    CHECK_EQ(m->reg[0x00], 0xff);   // IODIRA
+    CHECK_EQ(m->reg[0x01], 0xff);   // IODIRB
+    CHECK_EQ(m->reg[0x0c], 0xff);   // GPPUA
+    CHECK_EQ(m->reg[0x0d], 0xff);   // GPPUB
+    CHECK_EQ(m->reg[0x0a], 0x20);   // IOCON.SEQOP
+    CHECK_EQ(m->reg[0x04], 0);      // GPINTENA
+    CHECK_EQ(m->reg[0x05], 0);      // GPINTENB
+    CHECK(pad.xfer.keep_addr);
+}
+
+// A chip left in BANK = 1 is put back in BANK = 0 without writing its OLATA
+static void test_mcp23017_setup_bank1(void) {
+    struct mk_sim_mcp23017 *m;
+    struct mk_pad pad;
+
+    mk_sim_mcp23017_add(0x21, -1, true);
+    mcp_pad(&pad, 0, 0x21, false);
+    m = mk_sim_mcp23017(0x21);
+    CHECK_EQ(m->reg[0x0a], 0x20);
+    CHECK_EQ(m->reg[0x14], 0);      // OLATA
+    CHECK_EQ(m->reg[0x0c], 0xff);
+    CHECK_EQ(m->reg[0x0d], 0xff);
+    mk_sim_mcp23017_set(0x21, 0xfe, 0x7f);
+    CHECK_EQ(mk_mcp23017_read_packet(&pad), 0x8001);
+}
+
+// GPIOA holds the directions and the first buttons, GPIOB the other buttons
+static void test_mcp23017_read_packet(void) {
+    struct mk_pad pad;
+    int i;
+
+    mk_sim_mcp23017_add(0x20, -1, false);
+    mcp_pad(&pad, 0, 0x20, false);
+    CHECK_EQ(mk_mcp23017_read_packet(&pad), 0);
+    for (i = 0; i < 8; i++) {
+        mk_sim_mcp23017_set(0x20, ~(1 << i), 0xff);
+        CHECK_EQ(mk_mcp23017_read_packet(&pad), 1U << i);
+        mk_sim_mcp23017_set(0x20, 0xff, ~(1 << i));
+        CHECK_EQ(mk_mcp23017_read_packet(&pad), 1U << (i + 8));
+    }
+}
+
+// In byte mode, the polls after the first one skip the register address write
+static void test_mcp23017_byte_mode(void) {
+    struct mk_pad pad;
+    unsigned long xfers;
+    int i;
+
+    mk_sim_mcp23017_add(0x20, -1, false);
+    mcp_pad(&pad, 0, 0x20, false);
+    for (i = 0; i < 4; i++) {
+        mk_sim_mcp23017_set(0x20, ~(1 << i), ~(1 << (7 - i)));
+        xfers = mk_sim.bsc_xfers;
+        CHECK_EQ(bsc_submit(&pad.xfer), 0);
+        mk_sim_run_until(ktime_get() + 1000000);
+        CHECK_EQ(done_count, i + 1);
+        CHECK_EQ(done_err, 0);
+        CHECK_EQ(done_raw[0], (1U << i) | (1U << (15 - i)));
+        CHECK_EQ(mk_sim.bsc_xfers - xfers, i ? 1 : 2);
+    }
+}
+
+// A batch streams the reads of all expanders, a read still queued is not submitted again
+static void test_mcp23017_batch(void) {
+    struct bsc_xfer *batch[3];
+    struct mk_pad pads[3];
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        mk_sim_mcp23017_add(0x20 + i, -1, false);
+        mcp_pad(&pads[i], i, 0x20 + i, false);
+        mk_sim_mcp23017_set(0x20 + i, ~(1 << i), 0xff);
+        batch[i] = &pads[i].xfer;
+    }
+    CHECK_EQ(bsc_submit_batch(batch, 3), 3);
+    CHECK_EQ(bsc_submit_batch(batch, 3), 0);
+    mk_sim_run_until(ktime_get() + 2000000);
+    CHECK_EQ(done_count, 3);
+    for (i = 0; i < 3; i++)
+        CHECK_EQ(done_raw[i], 1U << i);
+    CHECK_EQ(bsc_submit_batch(batch, 3), 3);
+    mk_sim_run_until(ktime_get() + 2000000);
+    CHECK_EQ(done_count, 6);
+}
+
+// A missing expander fails the read without stopping the engine
+static void test_mcp23017_missing(void) {
+    struct bsc_xfer *batch[2];
+    struct mk_pad pads[2];
+
+    mk_sim_mcp23017_add(0x20, -1, false);
+    mcp_pad(&pads[0], 0, 0x27, false);
+    mcp_pad(&pads[1], 1, 0x20, false);
+    mk_sim_mcp23017_set(0x20, 0xfe, 0xff);
+    batch[0] = &pads[0].xfer;
+    CHECK_EQ(bsc_submit_batch(batch, 1), 1);
+    mk_sim_run_until(ktime_get() + 1000000);
+    CHECK_EQ(done_count, 1);
+    CHECK_EQ(done_err, -EIO);
+    batch[0] = &pads[1].xfer;
+    CHECK_EQ(bsc_submit_batch(batch, 1), 1);
+    mk_sim_run_until(ktime_get() + 1000000);
+    CHECK_EQ(done_count, 2);
+    CHECK_EQ(done_err, 0);
+    CHECK_EQ(done_raw[1], 1);
+}
+
+// A queued read is dropped, a running one is waited for
+static void test_mcp23017_cancel(void) {
+    struct bsc_xfer *batch[2];
+    struct mk_pad pads[2];
+
+    mk_sim_mcp23017_add(0x20, -1, false);
+    mk_sim_mcp23017_add(0x21, -1, false);
+    mcp_pad(&pads[0], 0, 0x20, false);
+    mcp_pad(&pads[1], 1, 0x21, false);
+    batch[0] = &pads[0].xfer;
+    batch[1] = &pads[1].xfer;
+    CHECK_EQ(bsc_submit_batch(batch, 2), 2);
+    bsc_cancel(&pads[1].xfer);
+    CHECK(!pads[1].xfer.queued);
+    CHECK_EQ(done_count, 0);
+    bsc_cancel(&pads[0].xfer);
+    CHECK_EQ(done_count, 1);
+    mk_sim_run_until(ktime_get() + 1000000);
+    CHECK_EQ(done_count, 1);
+}
+
+/*
+ * Interrupt mode : the expander raises its INT line on a change, and the handler reads
+ * the state INTCAP captured then the current one, as mk_mcp23017_irq() does
+ */
+
+#define INT_GPIO	25
+
+static struct mk_pad irq_pad;
+static int irq_count;
+static u32 irq_reports[16];
+static int irq_report_count;
+
+static void irq_report(u32 state) {
+    if (state == irq_pad.state)
+        return;
+    irq_pad.state = state;
+    if (irq_report_count < 16)
+        irq_reports[irq_report_count++] = state;
+}
+
+static void irq_handler(int gpio, void *data) {
+    u32 captured, current;
+    int err;
+
+    irq_count++;
+    err = mk_mcp23017_read_intcap(&irq_pad, &captured, &current);
+    CHECK_EQ(err, 0);
+    if (err)
+        return;
+    irq_report(captured);
+    irq_report(current);
+}
+
+static void irq_setup(void) {
+    mk_sim_mcp23017_add(0x20, INT_GPIO, false);
+    mcp_pad(&irq_pad, 0, 0x20, true);
+    irq_count = irq_report_count = 0;
+    mk_sim.irq_latency_ns = 50000;
+    CHECK_EQ(mk_sim_request_irq(INT_GPIO, MK_SIM_IRQ_LOW, irq_handler, NULL), 0);
+}
+
+// Both ports interrupt on any change, on one open-drain line left released
+static void test_mcp23017_irq_setup(void) {
+    struct mk_sim_mcp23017 *m;
+
+    irq_setup();
+    m = mk_sim_mcp23017(0x20);
+    CHECK_EQ(m->reg[0x0a], 0x44);   // IOCON.MIRROR | IOCON.ODR
+    CHECK_EQ(m->reg[0x04], 0xff);   // GPINTENA
+    CHECK_EQ(m->reg[0x05], 0xff);   // GPINTENB
+    CHECK_EQ(m->reg[0x08], 0);      // INTCONA, against the previous value
+    CHECK_EQ(m->reg[0x09], 0);
+    CHECK(!irq_pad.xfer.keep_addr);
+    CHECK(GPIO_READ(INT_GPIO));
+    mk_sim_run_until(ktime_get() + 1000000);
+    CHECK_EQ(irq_count, 0);
+}
+
+// A press and its release each raise the line once, the read releases it
+static void test_mcp23017_irq_press(void) {
+    irq_setup();
+    mk_sim_mcp23017_set(0x20, 0xfe, 0xff);
+    CHECK(!GPIO_READ(INT_GPIO));
+    mk_sim_run_until(ktime_get() + 1000000);
+    CHECK_EQ(irq_count, 1);
+    CHECK(GPIO_READ(INT_GPIO));
+    mk_sim_mcp23017_set(0x20, 0xff, 0xff);
+    mk_sim_run_until(ktime_get() + 1000000);
+    CHECK_EQ(irq_count, 2);
+    CHECK_EQ(irq_report_count, 2);
+    CHECK_EQ(irq_reports[0], 0x1);
+    CHECK_EQ(irq_reports[1], 0);
+}
+
+// With IOCON.MIRROR, a change on GPIOB raises the line on INTA too
+static void test_mcp23017_irq_port_b(void) {
+    irq_setup();
+    mk_sim_mcp23017_set(0x20, 0xff, 0x7f);
+    mk_sim_run_until(ktime_get() + 1000000);
+    CHECK_EQ(irq_count, 1);
+    CHECK_EQ(irq_report_count, 1);
+    CHECK_EQ(irq_reports[0], 0x8000);
+}
+
+// A tap released before the handler reads the chip is still reported, from INTCAP
+static void test_mcp23017_irq_tap(void) {
+    irq_setup();
+    mk_sim_mcp23017_set(0x20, 0xfb, 0xff);
+    mk_sim_run_until(ktime_get() + 10000);
+    mk_sim_mcp23017_set(0x20, 0xff, 0xff);
+    mk_sim_run_until(ktime_get() + 1000000);
+    CHECK_EQ(irq_report_count, 2);
+    CHECK_EQ(irq_reports[0], 0x4);
+    CHECK_EQ(irq_reports[1], 0);
+    // the release came before the read cleared the interrupt, so it raises nothing more
+    CHECK_EQ(irq_count, 1);
+    CHECK(GPIO_READ(INT_GPIO));
+}
+
+int main(void) {
+    RUN(test_mcp23017_setup);
+    RUN(test_mcp23017_setup_bank1);
+    RUN(test_mcp23017_read_packet);
+    RUN(test_mcp23017_byte_mode);
+    RUN(test_mcp23017_batch);
+    RUN(test_mcp23017_missing);
+    RUN(test_mcp23017_cancel);
+    RUN(test_mcp23017_irq_setup);
+    RUN(test_mcp23017_irq_press);
+    RUN(test_mcp23017_irq_port_b);
+    RUN(test_mcp23017_irq_tap);
+    return mk_test_result();
+}
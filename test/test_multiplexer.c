@@ -0,0 +1,116 @@
+/*
+ * Multiplexer pads, on simulated 4-bit multiplexers sharing their address lines
+ */
+
+#include "mk_test.h"
+
+static const int mux_addr[4] = { 5, 6, 13, 19 };
+
+static struct mk mk;
+
+static void mux_pad(struct mk_pad *pad, int idx, int sig, int start, int count) {
+    int b;
+
+    mk_test_pad(pad, idx, MK_ARCADE_GPIO_MULTIPLEXER);
+    for (b = 0; b < 4; b++)
+        pad->gpio_maps[b] = mux_addr[b];
+    pad->gpio_maps[4] = sig;
+    pad->start_offs = start;
+    pad->button_count = count;
+    pad->button_mask = MK_STATE_MASK(count);
+}
+
+// The address lines are outputs, and the scan walks the channels used by the pads
+static void mux_setup(struct mk_pad *pad, int start, int end, unsigned int settle_ns) {
+    int b;
+
+    memset(&mk, 0, sizeof(mk));
+    mk.mux_start = start;
+    mk.mux_end = end;
+    for (b = 0; b < 4; b++)
+        OUT_GPIO(mux_addr[b]);
+    mk_sim_mux_setup(mux_addr, settle_ns);
+    mk_setup_mux_table(&mk, pad);
+}
+
+// Each channel is read on its own bit once the address settled
+static void test_mux_channels(void) {
+    struct mk_pad pad;
+    u32 lev[16];
+    int i;
+
+    mux_pad(&pad, 0, 26, 0, 16);
+    mux_setup(&pad, 0, 16, 1000);
+    mk_sim_mux_add(26);
+    mk_multiplexer_scan(&mk, lev, 1000);
+    CHECK_EQ(mk_multiplexer_read_packet(&pad, lev), 0);
+    for (i = 0; i < 16; i++) {
+        mk_sim_mux_set(0, ~(1 << i));
+        mk_multiplexer_scan(&mk, lev, 1000);
+        CHECK_EQ(mk_multiplexer_read_packet(&pad, lev), 1U << i);
+    }
+    CHECK_EQ(mk_sim.mux_early, 0);
+}
+
+// Gray code order : one address line write per step after the first
+static void test_mux_gray_code(void) {
+    struct mk_pad pad;
+    unsigned long accesses;
+    u32 lev[16];
+    int i;
+
+    mux_pad(&pad, 0, 26, 0, 16);
+    mux_setup(&pad, 0, 16, 0);
+    mk_sim_mux_add(26);
+    CHECK_EQ(mk.mux_steps, 16);
+    for (i = 1; i < mk.mux_steps; i++)
+        CHECK_EQ(hweight32(mk.mux_set[i]) + hweight32(mk.mux_clr[i]), 1);
+    accesses = mk_sim_accesses();
+    mk_multiplexer_scan(&mk, lev, 0);
+    // the first step sets the whole address, then one write per step and one level read per channel
+    CHECK_EQ(mk_sim_accesses() - accesses, !!mk.mux_set[0] + !!mk.mux_clr[0] + 15 + 16);
+}
+
+// A settle time shorter than the multiplexer needs reads the previous channel
+static void test_mux_settle(void) {
+    struct mk_pad pad;
+    u32 lev[16];
+
+    mux_pad(&pad, 0, 26, 0, 16);
+    mux_setup(&pad, 0, 16, 1000);
+    mk_sim_mux_add(26);
+    mk_sim_mux_set(0, ~(1 << 0));
+    mk_multiplexer_scan(&mk, lev, 100);
+    CHECK(mk_sim.mux_early > 0);
+    CHECK(mk_multiplexer_read_packet(&pad, lev) != 1);
+}
+
+// Multiplexers on their own signal pins come from the same scan, a pad only reads its channels
+static void test_mux_shared(void) {
+    struct mk_pad pads[2];
+    unsigned long accesses;
+    u32 lev[16];
+
+    mux_pad(&pads[0], 0, 26, 4, 4);
+    mux_pad(&pads[1], 1, 21, 2, 8);
+    mux_setup(&pads[0], 2, 10, 500);
+    mk_sim_mux_add(26);
+    mk_sim_mux_add(21);
+    CHECK_EQ(mk.mux_steps, 8);
+    mk_sim_mux_set(0, ~((1 << 4) | (1 << 7) | (1 << 9)));
+    mk_sim_mux_set(1, ~((1 << 2) | (1 << 9) | (1 << 12)));
+    accesses = mk_sim_accesses();
+    mk_multiplexer_scan(&mk, lev, 500);
+    CHECK(mk_sim_accesses() - accesses <= 2 * 8 + 8);
+    CHECK_EQ(mk_multiplexer_read_packet(&pads[0], lev), 0x9);
+    CHECK_EQ(mk_multiplexer_read_packet(&pads[1], lev), 0x81);
+    CHECK_EQ(mk_sim.mux_early, 0);
+}
+
+int main(void) {
+    RUN(test_mux_channels);
+    RUN(test_mux_gray_code);
+    RUN(test_mux_settle);
+    RUN(test_mux_shared);
+    return mk_test_result();
+}
@@ -0,0 +1,152 @@
+/*
+ * Polling of the pads : their own rates, and the edges a latching pad caught between polls
+ */
+
+#include "mk_test.h"
+
+#define PERIOD		1000000
+
+// A pad is due on its own period grid, from the tick that first sees it
+static void test_poll_due(void) {
+    unsigned long overruns = 0;
+    struct mk_pad pad;
+
+    mk_test_pad(&pad, 0, MK_ARCADE_GPIO);
+    pad.period = PERIOD;
+    CHECK(mk_pad_due(&pad, 5000, &overruns));
+    CHECK(!mk_pad_due(&pad, 5000 + PERIOD / 2, &overruns));
+    CHECK(!mk_pad_due(&pad, 5000 + PERIOD - 1, &overruns));
+    CHECK(mk_pad_due(&pad, 5000 + PERIOD, &overruns));
+    // a late tick does not shift the grid
+    CHECK(mk_pad_due(&pad, 5000 + 2 * PERIOD + 300000, &overruns));
+    CHECK(!mk_pad_due(&pad, 5000 + 3 * PERIOD - 1, &overruns));
+    CHECK(mk_pad_due(&pad, 5000 + 3 * PERIOD, &overruns));
+    CHECK_EQ(overruns, 0);
+}
+
+// A pad polled every other tick, behind a faster one
+static void test_poll_rates(void) {
+    unsigned long overruns = 0;
+    struct mk_pad fast, slow;
+    int tick, fast_polls = 0, slow_polls = 0;
+
+    mk_test_pad(&fast, 0, MK_ARCADE_GPIO);
+    mk_test_pad(&slow, 1, MK_ARCADE_GPIO);
+    fast.period = PERIOD;
+    slow.period = 2 * PERIOD;
+    for (tick = 1; tick <= 100; tick++) {
+        fast_polls += mk_pad_due(&fast, tick * PERIOD, &overruns);
+        slow_polls += mk_pad_due(&slow, tick * PERIOD, &overruns);
+    }
+    CHECK_EQ(fast_polls, 100);
+    CHECK_EQ(slow_polls, 50);
+    CHECK_EQ(overruns, 0);
+}
+
+// The deadlines a tick came too late for are counted once, and skipped
+static void test_poll_missed(void) {
+    unsigned long overruns = 0;
+    struct mk_pad pad;
+
+    mk_test_pad(&pad, 0, MK_ARCADE_GPIO);
+    pad.period = PERIOD;
+    CHECK(mk_pad_due(&pad, 0, &overruns));
+    CHECK(mk_pad_due(&pad, PERIOD, &overruns));
+    // the deadlines at 2 and 3 periods are served by one poll at 3.5
+    CHECK(mk_pad_due(&pad, 3 * PERIOD + PERIOD / 2, &overruns));
+    CHECK_EQ(overruns, 1);
+    CHECK_EQ(pad.next_due, 4 * PERIOD);
+    CHECK(mk_pad_due(&pad, 10 * PERIOD, &overruns));
+    CHECK_EQ(overruns, 7);
+    CHECK_EQ(pad.next_due, 11 * PERIOD);
+}
+
+// Only the buttons back to their reported state are pulsed, the others come with the state
+static void test_poll_latch_pulse(void) {
+    struct mk_pad pad;
+
+    mk_test_pad(&pad, 0, MK_ARCADE_GPIO);
+    pad.button_mask = 0x1fff;
+    pad.state = 0x2;
+    // button 0 tapped, button 1 let go and pressed again, button 2 still pressed
+    CHECK_EQ(mk_gpio_latch_pulse(&pad, 0x6, 0x5, 0x2, MK_DEBOUNCE_OFF), 0x3);
+    // button 1 released for good, reported from the state alone
+    CHECK_EQ(mk_gpio_latch_pulse(&pad, 0x0, 0x0, 0x2, MK_DEBOUNCE_OFF), 0);
+    // no edge seen
+    CHECK_EQ(mk_gpio_latch_pulse(&pad, 0x2, 0x0, 0x0, MK_DEBOUNCE_OFF), 0);
+}
+
+// The deferred debounce drops all pulses, the eager one those of the buttons it locks out
+static void test_poll_latch_debounce(void) {
+    struct mk_pad pad;
+
+    mk_test_pad(&pad, 0, MK_ARCADE_GPIO);
+    pad.button_mask = 0x1fff;
+    CHECK_EQ(mk_gpio_latch_pulse(&pad, 0, 0x3, 0x3, MK_DEBOUNCE_DEFERRED), 0);
+    CHECK_EQ(mk_gpio_latch_pulse(&pad, 0, 0x3, 0x3, MK_DEBOUNCE_EAGER), 0x3);
+    pad.debounce[1] = 0x2;
+    CHECK_EQ(mk_gpio_latch_pulse(&pad, 0, 0x3, 0x3, MK_DEBOUNCE_EAGER), 0x1);
+}
+
+static struct mk mk;
+static unsigned long class_overruns[MK_MAX];
+
+// A latching GPIO pad polled by mk_process_packet()
+static struct mk_pad *latch_pad(void) {
+    struct mk_pad *pad;
+
+    mk_test_mk(&mk, class_overruns);
+    pad = mk_test_mk_pad(&mk, 0, MK_ARCADE_GPIO, PERIOD);
+    memcpy(pad->gpio_maps, mk_arcade_gpio_maps, 13 * sizeof(int));
+    mk_setup_gpio_table(pad, 13);
+    pad->latch = true;
+    return pad;
+}
+
+static void latch_press(void *data) {
+    mk_sim_set_pin(mk_arcade_gpio_maps[0], 0);
+    mk_gpio_latch_edge(data);
+}
+
+// A tap over before the poll is reported as a press then a release
+static void test_poll_latch_tap(void) {
+    struct mk_pad *pad = latch_pad();
+
+    mk_process_packet(&mk, PERIOD);
+    mk_sim_set_pin(mk_arcade_gpio_maps[0], 0);
+    mk_gpio_latch_edge(pad);
+    mk_sim_set_pin(mk_arcade_gpio_maps[0], 1);
+    mk_gpio_latch_edge(pad);
+    mk_process_packet(&mk, 2 * PERIOD);
+    CHECK_EQ(mk_test_report_count, 2);
+    CHECK_EQ(mk_test_reports[0].state, 0x1);
+    CHECK_EQ(mk_test_reports[1].state, 0x0);
+}
+
+// A press whose edge lands right after the level snapshot of a tick is not taken for a tap,
+// it is reported once by the next tick
+static void test_poll_latch_after_snapshot(void) {
+    struct mk_pad *pad = latch_pad();
+
+    mk_process_packet(&mk, PERIOD);
+    mk_sim.after_lev = latch_press;
+    mk_sim.after_lev_data = pad;
+    mk_process_packet(&mk, 2 * PERIOD);
+    CHECK_EQ(mk_test_report_count, 0);
+    mk_process_packet(&mk, 3 * PERIOD);
+    CHECK_EQ(mk_test_report_count, 1);
+    CHECK_EQ(mk_test_reports[0].state, 0x1);
+    mk_process_packet(&mk, 4 * PERIOD);
+    CHECK_EQ(mk_test_report_count, 1);
+}
+
+int main(void) {
+    RUN(test_poll_due);
+    RUN(test_poll_rates);
+    RUN(test_poll_missed);
+    RUN(test_poll_latch_pulse);
+    RUN(test_poll_latch_debounce);
+    RUN(test_poll_latch_tap);
+    RUN(test_poll_latch_after_snapshot);
+    return mk_test_result();
+}